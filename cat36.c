@@ -97,8 +97,8 @@ default_formats (const char *argv0)
 static void
 convert (char *argv0, char *file)
 {
-  word_t word, tape;
-  size_t count;
+  word_t buffer[4096], word, tape;
+  size_t i, n, count;
   FILE *f;
 
   if (file == NULL)
@@ -114,19 +114,28 @@ convert (char *argv0, char *file)
         }
     }
 
+  /* Regular files are read from memory. */
+  map_word_file (f);
+
   /* Put tape marks between input files. */
   tape = START_FILE;
   count = 0;
 
-  while ((word = get_word (f)) != -1)
+  while ((n = get_words (f, buffer, sizeof buffer / sizeof buffer[0])) > 0)
     {
-      if (block == 0) /* If -B was supplied, ignore input tape structure. */
-        tape |= word & (START_FILE | START_RECORD | START_TAPE);
-      write_word (stdout, (word & mask) | tape);
-      count++;
-      tape = !block || (count % block) ? 0 : START_RECORD;
+      for (i = 0; i < n; i++)
+        {
+          word = buffer[i];
+          if (block == 0) /* If -B was supplied, ignore input tape structure. */
+            tape |= word & (START_FILE | START_RECORD | START_TAPE);
+          buffer[i] = (word & mask) | tape;
+          count++;
+          tape = !block || (count % block) ? 0 : START_RECORD;
+        }
+      write_words (stdout, buffer, n);
     }
 
+  unmap_word_file (f);
   if (f != stdin)
     fclose (f);
 }
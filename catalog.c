@@ -0,0 +1,392 @@
+/* Copyright (C) 2026 Lars Brinkhoff <lars@nocrew.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* A catalog of the files on many DECtape images, so that finding the
+   tape with a file doesn't mean reading every image.  The images are
+   read on a pool of threads, and the catalog is a text file with one
+   line per file: the image name, the file name, the number of blocks,
+   and the date or "-", separated by tabs. */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dis.h"
+#include "catalog.h"
+
+/* One tape image to catalog, and the files found on it. */
+struct tape {
+  char *name;
+  struct catalog_file *file;
+  int files;
+  int error;
+  int done;
+};
+
+static struct tape *tapes;
+static size_t ntapes;
+static size_t next_tape;
+static size_t next_report;
+static pthread_mutex_t catalog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static catalog_tape_t *catalog_tape;
+static FILE *output;
+static struct stat output_stat;
+
+/* Read a DECtape image into memory, and clear what's past the end of
+   it.  Return -1 with errno set if it can't be opened. */
+int
+read_catalog_image (const char *name, struct word_format *format,
+		    word_t *image, size_t size)
+{
+  struct word_stream s;
+  size_t n, got;
+  FILE *f;
+
+  f = fopen (name, "rb");
+  if (f == NULL)
+    return -1;
+
+  init_word_stream (&s, f, format);
+  map_word_stream (&s);
+  for (n = 0; n < size; n += got)
+    {
+      got = stream_get_words (&s, image + n, size - n);
+      if (got == 0)
+	break;
+    }
+  memset (image + n, 0, (size - n) * sizeof *image);
+  free_word_stream (&s);
+  fclose (f);
+  return 0;
+}
+
+/* A file name with the padding taken out, like "FOO BIN". */
+static void
+file_name (char *name, word_t fn1, word_t fn2)
+{
+  char *p;
+
+  sixbit_to_ascii (fn1, name);
+  for (p = name + 6; p > name && p[-1] == ' '; p--)
+    ;
+  *p++ = ' ';
+  sixbit_to_ascii (fn2, p);
+  for (p += 6; p > name && p[-1] == ' '; p--)
+    ;
+  *p = 0;
+}
+
+static void
+report_tape (struct tape *t)
+{
+  char name[14];
+  int i;
+
+  if (t->error == EINVAL)
+    {
+      fprintf (stderr, "%s: Not a DECtape image\n", t->name);
+      return;
+    }
+  if (t->error)
+    {
+      fprintf (stderr, "%s: %s\n", t->name, strerror (t->error));
+      return;
+    }
+
+  for (i = 0; i < t->files; i++)
+    {
+      file_name (name, t->file[i].fn1, t->file[i].fn2);
+      fprintf (output, "%s\t%s\t%d\t", t->name, name, t->file[i].blocks);
+      if (t->file[i].date)
+	print_dec_timestamp (output, t->file[i].date);
+      else
+	fputc ('-', output);
+      fputc ('\n', output);
+    }
+}
+
+/* Take the next tape to read, and write those done in order. */
+static void *
+catalog_worker (void *arg)
+{
+  struct tape *t;
+  size_t i;
+
+  (void)arg;
+  for (;;)
+    {
+      pthread_mutex_lock (&catalog_lock);
+      i = next_tape++;
+      pthread_mutex_unlock (&catalog_lock);
+      if (i >= ntapes)
+	break;
+
+      t = &tapes[i];
+      t->file = malloc (CATALOG_FILES * sizeof *t->file);
+      if (t->file == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      t->files = catalog_tape (t->name, t->file);
+      if (t->files == -1)
+	t->error = errno;
+
+      pthread_mutex_lock (&catalog_lock);
+      t->done = 1;
+      while (next_report < ntapes && tapes[next_report].done)
+	{
+	  report_tape (&tapes[next_report]);
+	  free (tapes[next_report].name);
+	  free (tapes[next_report].file);
+	  next_report++;
+	}
+      pthread_mutex_unlock (&catalog_lock);
+    }
+
+  return NULL;
+}
+
+static void
+add_tape (const char *name)
+{
+  struct tape *t;
+
+  if ((ntapes & (ntapes - 1)) == 0)
+    {
+      t = realloc (tapes, (ntapes == 0 ? 64 : 2 * ntapes) * sizeof *t);
+      if (t == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      tapes = t;
+    }
+
+  t = &tapes[ntapes++];
+  memset (t, 0, sizeof *t);
+  t->name = strdup (name);
+}
+
+static int
+not_dot (const struct dirent *d)
+{
+  return strcmp (d->d_name, ".") != 0 && strcmp (d->d_name, "..") != 0;
+}
+
+/* Add a tape image, or the images in a directory and below.  The
+   catalog being written is not an image. */
+static void
+add_tapes (const char *name, int top)
+{
+  struct dirent **entry;
+  struct stat st;
+  size_t length;
+  char *path;
+  int i, n;
+
+  /* The error opening a missing file is reported with the rest. */
+  if (stat (name, &st) == -1)
+    {
+      add_tape (name);
+      return;
+    }
+
+  if (!S_ISDIR (st.st_mode))
+    {
+      if (st.st_dev == output_stat.st_dev && st.st_ino == output_stat.st_ino)
+	return;
+      if (top || S_ISREG (st.st_mode))
+	add_tape (name);
+      return;
+    }
+
+  n = scandir (name, &entry, not_dot, alphasort);
+  if (n == -1)
+    {
+      fprintf (stderr, "%s: %s\n", name, strerror (errno));
+      exit (1);
+    }
+  /* No double slash in the paths when the name ends with one. */
+  length = strlen (name);
+  while (length > 1 && name[length - 1] == '/')
+    length--;
+  for (i = 0; i < n; i++)
+    {
+      path = malloc (length + strlen (entry[i]->d_name) + 2);
+      if (path == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      sprintf (path, "%.*s/%s", (int)length, name, entry[i]->d_name);
+      add_tapes (path, 0);
+      free (path);
+      free (entry[i]);
+    }
+  free (entry);
+}
+
+/* Write a catalog of the named tape images, and the images in named
+   directories, using the given number of threads or one per
+   processor. */
+void
+build_catalog (const char *catalog, char **names, int n, int threads,
+	       catalog_tape_t *tape)
+{
+  pthread_t *thread;
+  int i, started;
+
+  output = fopen (catalog, "w");
+  if (output == NULL)
+    {
+      fprintf (stderr, "Error opening catalog file %s\n", catalog);
+      exit (1);
+    }
+  fstat (fileno (output), &output_stat);
+
+  for (i = 0; i < n; i++)
+    add_tapes (names[i], 1);
+
+  if (threads <= 0)
+    threads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+  if ((size_t)threads > ntapes)
+    threads = ntapes;
+
+  catalog_tape = tape;
+  thread = malloc ((threads + 1) * sizeof *thread);
+  if (thread == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  for (started = 0; started < threads; started++)
+    if (pthread_create (&thread[started], NULL, catalog_worker, NULL) != 0)
+      break;
+  if (started == 0)
+    catalog_worker (NULL);
+  for (i = 0; i < started; i++)
+    pthread_join (thread[i], NULL);
+  free (thread);
+  free (tapes);
+
+  if (fclose (output) != 0)
+    {
+      fprintf (stderr, "Error writing catalog file %s\n", catalog);
+      exit (1);
+    }
+}
+
+/* Upper case, with one space between the names. */
+static char *
+normalize (const char *name)
+{
+  char *p, *normal = malloc (strlen (name) + 1);
+  int space = 0;
+
+  if (normal == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  for (p = normal; *name != 0; name++)
+    {
+      if (isspace ((unsigned char)*name))
+	space = p > normal;
+      else
+	{
+	  if (space)
+	    *p++ = ' ';
+	  *p++ = toupper ((unsigned char)*name);
+	  space = 0;
+	}
+    }
+  *p = 0;
+  return normal;
+}
+
+/* Print the catalog lines with files matching any of the names, which
+   may have wildcards.  Only the catalog is read, not the images.
+   Return the number of lines printed. */
+int
+query_catalog (const char *catalog, char **names, int n)
+{
+  char *line = NULL, *name, *end, **pattern;
+  size_t size = 0;
+  int i, found = 0;
+  FILE *f;
+
+  f = fopen (catalog, "r");
+  if (f == NULL)
+    {
+      fprintf (stderr, "Error opening catalog file %s\n", catalog);
+      exit (1);
+    }
+
+  pattern = malloc ((n + 1) * sizeof *pattern);
+  if (pattern == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  for (i = 0; i < n; i++)
+    pattern[i] = normalize (names[i]);
+
+  while (getline (&line, &size, f) != -1)
+    {
+      /* The file name is the third field from the end, since an image
+	 name could have a tab. */
+      end = strrchr (line, '\t');
+      if (end == NULL)
+	continue;
+      *end = 0;
+      end = strrchr (line, '\t');
+      if (end == NULL)
+	continue;
+      *end = 0;
+      name = strrchr (line, '\t');
+      if (name == NULL)
+	continue;
+
+      for (i = 0; i < n; i++)
+	if (fnmatch (pattern[i], name + 1, 0) == 0)
+	  break;
+      if (i == n)
+	continue;
+
+      /* Put the line back together. */
+      end[0] = '\t';
+      end[strlen (end)] = '\t';
+      fputs (line, stdout);
+      found++;
+    }
+
+  for (i = 0; i < n; i++)
+    free (pattern[i]);
+  free (pattern);
+  free (line);
+  fclose (f);
+  return found;
+}
@@ -0,0 +1,39 @@
+/* Copyright (C) 2026 Lars Brinkhoff <lars@nocrew.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <stddef.h>
+#include "libword.h"
+
+/* More than any DECtape directory holds. */
+#define CATALOG_FILES 64
+
+/* A file on a DECtape, as listed in a catalog. */
+struct catalog_file {
+  word_t fn1, fn2;
+  int blocks;
+  int date;	/* DEC timestamp, or 0 if none. */
+};
+
+/* Fill in file with the files on the tape image named name, and
+   return how many there are.  Return -1 with errno set if the image
+   can't be read, or to EINVAL if it doesn't look like a DECtape.
+   Called from several threads at once. */
+typedef int catalog_tape_t (const char *name, struct catalog_file *file);
+
+extern int	read_catalog_image (const char *name, struct word_format *,
+				    word_t *image, size_t size);
+extern void	build_catalog (const char *catalog, char **names, int n,
+			       int threads, catalog_tape_t *tape);
+extern int	query_catalog (const char *catalog, char **names, int n);
@@ -17,8 +17,8 @@ test_dis10() {
 }
 
 test_itsarc() {
-    ./itsarc -t samples/"$1" 2> out/"$1".list
-    compare "$1.list"
+    ./itsarc ${2:--t} samples/"$1" 2> out/"$1".${3:-list}
+    compare "$1.${3:-list}"
 }
 
 test_ipak() {
@@ -33,6 +33,21 @@ test_dart() {
     compare "$1.dart"
 }
 
+test_tendmp() {
+    ./tendmp -c out/"$1".dta samples/"$1" samples/"$2"
+    ./tendmp -c out/"$2".dta samples/"$2" samples/"$3"
+    ./tendmp -i out/tendmp.catalog out/"$1".dta out/"$2".dta
+    ./tendmp -q out/tendmp.catalog "$4" > out/"$2".tendmp
+    compare "$2.tendmp"
+}
+
+test_magdmp() {
+    ./magfrm "$1" samples/"$2" samples/"$3" samples/"$4" > out/"$2$1".tape 2> /dev/null
+    ./magdmp "$1" out/"$2$1".tape 2> out/"$2".magdmp
+    cat out/"$2$1".tape | ./magdmp "$1" /dev/stdin 2>> out/"$2".magdmp
+    compare "$2.magdmp"
+}
+
 test_scrmbl() {
     ./scrmbl -Wbin "$1" samples/zeros.scrmbl out/"$1".scrmbl
     ./cat36 -Wits -Xbin out/"$1".scrmbl | cmp - samples/zeros."$1".scrmbl || \
@@ -48,6 +63,29 @@ test_cat36() {
     compare "$1"."$2"."$3"
 }
 
+test_auto() {
+    cat samples/"$1" | ./cat36 -Wauto -Xoct > out/"$1".auto
+    if ./cat36 -W"$2" -Xoct samples/"$1" | cmp - out/"$1".auto; then
+        echo "OK: $1.auto"
+    else
+        echo "FAIL: $1.auto"
+    fi
+}
+
+test_compressed() {
+    "$2" -c samples/"$1" | ./cat36 -W"$3" -Xoct > out/"$1"."$2"
+    if ./cat36 -W"$3" -Xoct samples/"$1" | cmp - out/"$1"."$2"; then
+        echo "OK: $1.$2"
+    else
+        echo "FAIL: $1.$2"
+    fi
+}
+
+test_classify() {
+    ./classify-tape $2 samples/"$1" > out/"$1".${3:-classify}
+    compare "$1.${3:-classify}"
+}
+
 test_dump() {
     ./dump $2 samples/"$1" > out/"$1".dump 2> /dev/null
     compare "$1.dump"
@@ -82,8 +120,12 @@ test_dis10 cerber.sav     "-Sall -Fcsave -Wascii"
 test_dis10 eftp.sav       "-Ftenex -Walto"
 
 test_itsarc arc.code
+test_itsarc arc.code -l dir
 test_ipak stink.-ipak-
 test_dart dart.tape
+test_tendmp ts.name visib1.bin ts.obs "visib1 bin"
+test_magdmp -9 atsign.tcp its.bin midas6.bin
+test_magdmp -7 atsign.tcp its.bin midas6.bin
 
 test_scrmbl thirty
 test_scrmbl sixbit
@@ -94,6 +136,21 @@ test_scrmbl 0s
 test_cat36 chars.pub oct sail
 test_cat36 chars.pub sail ascii
 
+test_auto ts.obs         its
+test_auto macro.low      ascii
+test_auto pt.rim         pt
+test_auto dart.dmp       data8
+test_auto two.tapes      tape
+test_auto chars.pub.oct  oct
+test_auto chars.pub.sail sail
+
+test_compressed ts.obs    gzip its
+test_compressed two.tapes xz   tape
+
+test_classify two.tapes
+test_classify dart.tape "-j" json
+test_classify dart.tape "-a -t"
+
 test_dump pt.rim      "-Frim10 -Wpt -Osblk"
 test_dump system.dmp  "-Fdmp -Woct -Xoct -Odmp"
 test_dump ts.srccom   "-Wits -Opdump"
@@ -13,29 +13,50 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
+/* Classify a tape image from standard input, or a corpus of images
+   named on the command line.  Directories are searched for images.
+   The images in a corpus are classified on a pool of threads, each
+   with its own state below, and reported one line per image in the
+   order given, as CSV or JSON.  A single image can also be classified
+   one file at a time, to map out a tape with mixed contents. */
+
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
 #include <getopt.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "tape-image.h"
 
 typedef unsigned long long word_t;
 
-static uint8_t image[1024 * 1024];
-static uint8_t *ptr = image;
+#define IMAGE_SIZE (1024 * 1024)
 
 static int eot_flag = 0;
 static int unknown_flag = 0;
 static int tape_format_flag = 0;
+static int json_flag = 0;
+static int all_flag = 0;
+
+static __thread FILE *tape;
+static __thread uint8_t *image;
+static __thread uint8_t *ptr;
 
-static int big_endian = 0;
-static int track_7 = 0;
-static int track_9 = 0;
-static int simh = 0;
-static int e11 = 0;
-static int ansi = 0;
+static __thread int track_7 = 0;
+static __thread int track_9 = 0;
+static __thread int simh = 0;
+static __thread int e11 = 0;
+static __thread int ansi = 0;
+
+/* Where to go when an image in a corpus is malformed. */
+static __thread jmp_buf bad_tape;
+static __thread char *bad_tape_message;
 
 static uint32_t
 read_16bits_l (uint8_t *start)
@@ -79,19 +100,19 @@ read_36bits (uint8_t *x)
 static void
 check_eot (void)
 {
+  uint8_t *buffer = NULL;
+  size_t size = 0, n;
   int eof = 0;
   uint32_t len;
 
   for (;;)
     {
-      len = read_record (stdin, image, sizeof image);
+      len = read_record_alloc (tape, &buffer, &size);
       if (len == 0 && eof)
         {
-          int n = 0;
-          while (getchar () != EOF)
-            n++;
+          n = skip_tape_image (tape);
           if (n > 4)
-            printf ("Data after logical end of tape: %d octets.\n", n);
+            printf ("Data after logical end of tape: %zu octets.\n", n);
           exit (0);
         }
       eof = (len == 0);
@@ -300,12 +321,12 @@ its_dump_label (uint8_t *data, uint32_t len)
   if (read_36bits (data + 9 * 6) != 0)
     return 0;
 
-  len = read_record (stdin, ptr, sizeof image - (ptr - image));
+  len = read_record (tape, ptr, IMAGE_SIZE - (ptr - image));
   if (len < 0x80000000)
     ptr += len;
   while (len == 0 || (len & 0x80000000) != 0)
     {
-      len = read_record (stdin, ptr, sizeof image - (ptr - image));
+      len = read_record (tape, ptr, IMAGE_SIZE - (ptr - image));
       if (len < 0x80000000)
         ptr += len;
     }
@@ -364,33 +385,17 @@ dos_fat (uint8_t *data)
   return 1;
 }
 
-int main (int argc, char **argv)
+/* Read up to the first data record which isn't an ANSI label. */
+static uint8_t *
+first_record (uint32_t *length)
 {
   uint32_t len;
   uint8_t *data;
-  int opt;
 
-  while ((opt = getopt (argc, argv, "etu")) != -1)
-    switch (opt)
-      {
-      case 'e':
-        eot_flag = 1;
-        break;
-      case 'u':
-        unknown_flag = 1;
-        break;
-      case 't':
-        tape_format_flag = 1;
-        break;
-      default:
-        fprintf (stderr, "Usage: %s [-eut]\n", argv[0]);
-        exit (1);
-      }
-  
   for (;;)
     {
       data = ptr;
-      len = read_record (stdin, ptr, sizeof image - (ptr - image));
+      len = read_record (tape, ptr, IMAGE_SIZE - (ptr - image));
       if ((len == 0) || (len & 0x80000000) != 0)
         continue;
       ptr += len;
@@ -404,94 +409,531 @@ int main (int argc, char **argv)
       break;
     }
 
+  *length = len;
+  return data;
+}
+
+/* Return the name of the format of the tape starting with the data
+   record, or NULL if it's unknown. */
+static const char *
+classify (uint8_t *data, uint32_t len)
+{
   if ((len % (518 * 5)) == 0)
-    {
-      printf ("TOPS-20 DUMPER");
-    }
+    return "TOPS-20 DUMPER";
 #if 0
   else if (len == 5120)
-    {
-      printf ("ITS DUMP");
-    }
+    return "ITS DUMP";
   else if (len == 6144)
-    {
-      printf ("ITS DUMP");
-    }
+    return "ITS DUMP";
 #endif
   else if (its_dump (data, len))
-    {
-      printf ("ITS DUMP");
-    }
+    return "ITS DUMP";
   else if (its_dump_label (data, len))
+    return "ITS DUMP (with label)";
+  else if (strstr ((const char *)data, "TAPE-SYSTEM-VERSION") != NULL)
+    return "Symbolics LMFS dump";
+  else if (strstr ((const char *)data, "LMFL(") != NULL)
+    return "MIT/LMI dump";
+  else if (vms_backup (data, len))
+    return "VMS BACKUP";
+  else if (memcmp (data + 257, "ustar", 5) == 0)
+    return "Unix ustar";
+  else if (unix_16bit_tar (data, len))
+    return "Unix 16-bit tar";
+  else if (memcmp (data + 24, "\x6C\xEA\x00\x00", 4) == 0)
+    return "Unix little endian 32-bit dump";
+  else if (memcmp (data + 24, "\x00\x00\xEA\x6C", 4) == 0)
+    return "Unix big endian 32-bit dump";
+  else if (memcmp (data + 24, "\x6B\xEA\x00\x00", 4) == 0)
+    return "Unix little endian 32-bit old dump";
+  else if (memcmp (data + 24, "\x00\x00\xEA\x6B", 4) == 0)
+    return "Unix big endian 32-bit old dump";
+  else if (memcmp (data + 18, "\x6B\xEA", 2) == 0)
+    return "Unix 16-bit dump";
+  else if (tops20_install (data, len))
+    return "TOPS-20 install";
+  else if (len == 544 * 5)
+    return "TOPS-10 BACKUP";
+  else if (tops10_failsafe (data, len))
+    return "TOPS-10 FAILSAFE";
+  else if (dos_fat (data))
+    return "FAT file system";
+  else if (unix_cpio (data))
+    return "Unix cpio";
+#if 0
+  else if (asciz_text (data, len))
+    return "Raw text";
+#endif
+  else
+    return NULL;
+}
+
+/* The heuristics may look past the end of a record, and expect to
+   find zeros there. */
+static void
+clear_image (void)
+{
+  memset (image, 0, ptr - image);
+  ptr = image;
+}
+
+static void
+reset_state (FILE *f)
+{
+  tape = f;
+  if (image == NULL)
+    ptr = image = calloc (1, IMAGE_SIZE);
+  if (image == NULL)
     {
-      printf ("ITS DUMP (with label)");
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
     }
-  else if (strstr ((const char *)data, "TAPE-SYSTEM-VERSION") != NULL)
+  clear_image ();
+  track_7 = track_9 = simh = e11 = ansi = 0;
+}
+
+static void
+tape_padding (void)
+{
+  switch (tape_image_padding ())
     {
-      printf ("Symbolics LMFS dump");
+    case 0: e11 = 1; break;
+    case 1: simh = 1; break;
     }
-  else if (strstr ((const char *)data, "LMFL(") != NULL)
+}
+
+static void
+print_tape_format (void)
+{
+  tape_padding ();
+  printf ("  [");
+  if (track_7)
+    printf ("7-track, ");
+  if (track_9)
+    printf ("9-track, ");
+  printf ("%s-endian",
+          tape_image_big_endian () ? "big" : "little");
+  if (e11)
+    printf (", E11");
+  if (simh)
+    printf (", SIMH");
+  printf ("]");
+}
+
+/* Classify each file on the tape by its first record, and skip the
+   rest of it without keeping anything.  Files are numbered like for
+   seek_tape_file: separated by one or more tape marks, from 0.  The
+   octet offset of each file's first record is printed too. */
+static void
+classify_files (void)
+{
+  const char *format;
+  size_t records;
+  long offset, next;
+  uint32_t len;
+  int file;
+
+  for (file = 0; !end_of_tape_image (tape); file++)
     {
-      printf ("MIT/LMI dump");
+      clear_image ();
+      do
+        {
+          offset = tape_image_offset (tape);
+          len = read_record (tape, image, IMAGE_SIZE);
+        }
+      while ((len == 0 || (len & 0x80000000) != 0)
+             && !end_of_tape_image (tape));
+      if (len == 0 || (len & 0x80000000) != 0)
+        break;
+
+      ptr = image + len;
+      track_7 = track_9 = ansi = 0;
+      next = tape_image_offset (tape);
+      if (ansi_label (image, len))
+        format = "ANSI label";
+      else if ((format = classify (image, len)) == NULL)
+        format = "Unknown";
+
+      /* Some heuristics look at the following records. */
+      if (tape_image_offset (tape) != next)
+        seek_tape_image (tape, next);
+      records = 1;
+      skip_tape_file (tape, &records);
+
+      printf ("File %d at octet %ld, %zu record%s: %s", file, offset,
+              records, records == 1 ? "" : "s", format);
+      if (tape_format_flag)
+        print_tape_format ();
+      putchar ('\n');
     }
-  else if (vms_backup (data, len))
+}
+
+/* One tape in a corpus, and what was found. */
+struct tape {
+  char *name;
+  const char *format;
+  char *error;
+  int track_7, track_9, big_endian, e11, simh, ansi;
+  size_t records;
+  int done;
+};
+
+static struct tape *tapes;
+static size_t ntapes;
+static size_t next_tape;
+static size_t next_report;
+static pthread_mutex_t corpus_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Keep the first line of the message.  The record being read may
+   already be partly in the buffer, anywhere past ptr, so all of it is
+   cleared before the next image. */
+static void
+bad_tape_hook (const char *message)
+{
+  bad_tape_message = strndup (message, strcspn (message, "\n"));
+  ptr = image + IMAGE_SIZE;
+  longjmp (bad_tape, 1);
+}
+
+static void
+classify_tape (struct tape *t)
+{
+  uint32_t len;
+  uint8_t *data;
+  FILE *f;
+
+  f = fopen (t->name, "rb");
+  if (f == NULL)
     {
-      printf ("VMS BACKUP");
+      t->error = strdup (strerror (errno));
+      return;
     }
-  else if (memcmp (data + 257, "ustar", 5) == 0)
+
+  reset_state (f);
+  if (setjmp (bad_tape) == 0)
     {
-      printf ("Unix ustar");
+      data = first_record (&len);
+      t->format = classify (data, len);
+      if (t->format == NULL)
+        t->format = "Unknown";
     }
-  else if (unix_16bit_tar (data, len))
+  else
+    t->error = bad_tape_message;
+
+  tape_padding ();
+  t->track_7 = track_7;
+  t->track_9 = track_9;
+  t->big_endian = tape_image_big_endian ();
+  t->ansi = ansi;
+  close_tape_image (f);
+
+  /* Count the records from the start, now without the data. */
+  if (t->error == NULL)
+    {
+      rewind (f);
+      if (setjmp (bad_tape) == 0)
+        t->records = count_records (f);
+      else
+        t->error = bad_tape_message;
+      tape_padding ();
+      close_tape_image (f);
+    }
+  t->e11 = e11;
+  t->simh = simh;
+  fclose (f);
+}
+
+static void
+csv_string (const char *string)
+{
+  putchar ('"');
+  for (; *string != 0; string++)
     {
-      printf ("Unix 16-bit tar");
+      if (*string == '"')
+        putchar ('"');
+      putchar (*string);
     }
-  else if (memcmp (data + 24, "\x6C\xEA\x00\x00", 4) == 0)
+  putchar ('"');
+}
+
+static void
+json_string (const char *string)
+{
+  putchar ('"');
+  for (; *string != 0; string++)
     {
-      printf ("Unix little endian 32-bit dump");
+      if (*string == '"' || *string == '\\')
+        printf ("\\%c", *string);
+      else if ((unsigned char)*string < 32)
+        printf ("\\u%04x", *string);
+      else
+        putchar (*string);
     }
-  else if (memcmp (data + 24, "\x00\x00\xEA\x6C", 4) == 0)
+  putchar ('"');
+}
+
+static void
+report_tape (struct tape *t)
+{
+  const char *tracks = t->track_7 ? "7" : t->track_9 ? "9" : "";
+  const char *endian = t->big_endian ? "big" : "little";
+  const char *container = t->e11 ? "E11" : t->simh ? "SIMH" : "";
+  const char *format = t->format != NULL ? t->format : "";
+
+  if (json_flag)
+    {
+      printf ("{\"file\":");
+      json_string (t->name);
+      printf (",\"format\":");
+      json_string (format);
+      printf (",\"tracks\":%s,\"endian\":\"%s\",\"container\":",
+              *tracks ? tracks : "null", endian);
+      if (*container)
+        printf ("\"%s\"", container);
+      else
+        printf ("null");
+      printf (",\"ansi\":%s,\"records\":%zu,\"error\":",
+              t->ansi ? "true" : "false", t->records);
+      if (t->error != NULL)
+        json_string (t->error);
+      else
+        printf ("null");
+      printf ("}\n");
+    }
+  else
     {
-      printf ("Unix big endian 32-bit dump");
+      csv_string (t->name);
+      putchar (',');
+      csv_string (format);
+      printf (",%s,%s,%s,%s,%zu,", tracks, endian, container,
+              t->ansi ? "yes" : "no", t->records);
+      if (t->error != NULL)
+        csv_string (t->error);
+      putchar ('\n');
     }
-  else if (memcmp (data + 24, "\x6B\xEA\x00\x00", 4) == 0)
+}
+
+/* Take the next tape to classify, and report those done in order. */
+static void *
+corpus_worker (void *arg)
+{
+  struct tape *t;
+  size_t i;
+
+  (void)arg;
+  for (;;)
     {
-      printf ("Unix little endian 32-bit old dump");
+      pthread_mutex_lock (&corpus_lock);
+      i = next_tape++;
+      pthread_mutex_unlock (&corpus_lock);
+      if (i >= ntapes)
+        break;
+
+      t = &tapes[i];
+      classify_tape (t);
+
+      pthread_mutex_lock (&corpus_lock);
+      t->done = 1;
+      while (next_report < ntapes && tapes[next_report].done)
+        {
+          report_tape (&tapes[next_report]);
+          free (tapes[next_report].name);
+          free (tapes[next_report].error);
+          next_report++;
+        }
+      pthread_mutex_unlock (&corpus_lock);
     }
-  else if (memcmp (data + 24, "\x00\x00\xEA\x6B", 4) == 0)
+
+  free (image);
+  image = NULL;
+  return NULL;
+}
+
+static void
+add_tape (const char *name)
+{
+  struct tape *t;
+
+  if ((ntapes & (ntapes - 1)) == 0)
     {
-      printf ("Unix big endian 32-bit old dump");
+      t = realloc (tapes, (ntapes == 0 ? 64 : 2 * ntapes) * sizeof *t);
+      if (t == NULL)
+        {
+          fprintf (stderr, "Out of memory.\n");
+          exit (1);
+        }
+      tapes = t;
     }
-  else if (memcmp (data + 18, "\x6B\xEA", 2) == 0)
+
+  t = &tapes[ntapes++];
+  memset (t, 0, sizeof *t);
+  t->name = strdup (name);
+}
+
+static int
+not_dot (const struct dirent *d)
+{
+  return strcmp (d->d_name, ".") != 0 && strcmp (d->d_name, "..") != 0;
+}
+
+/* Add a tape image, or the images in a directory and below.  Tape
+   index sidecars are not images. */
+static void
+add_tapes (const char *name, int top)
+{
+  struct dirent **entry;
+  struct stat st;
+  size_t length;
+  char *path;
+  int i, n;
+
+  /* The error opening a missing file is reported with the rest. */
+  if (stat (name, &st) == -1)
     {
-      printf ("Unix 16-bit dump");
+      add_tape (name);
+      return;
     }
-  else if (tops20_install (data, len))
+
+  if (!S_ISDIR (st.st_mode))
     {
-      printf ("TOPS-20 install");
+      length = strlen (name);
+      if (top || (S_ISREG (st.st_mode)
+                  && (length < 6 || strcmp (name + length - 6, ".index") != 0)))
+        add_tape (name);
+      return;
     }
-  else if (len == 544 * 5)
+
+  n = scandir (name, &entry, not_dot, alphasort);
+  if (n == -1)
     {
-      printf ("TOPS-10 BACKUP");
+      fprintf (stderr, "%s: %s\n", name, strerror (errno));
+      exit (1);
     }
-  else if (tops10_failsafe (data, len))
+  /* No double slash in the paths when the name ends with one. */
+  length = strlen (name);
+  while (length > 1 && name[length - 1] == '/')
+    length--;
+  for (i = 0; i < n; i++)
     {
-      printf ("TOPS-10 FAILSAFE");
+      path = malloc (length + strlen (entry[i]->d_name) + 2);
+      if (path == NULL)
+        {
+          fprintf (stderr, "Out of memory.\n");
+          exit (1);
+        }
+      sprintf (path, "%.*s/%s", (int)length, name, entry[i]->d_name);
+      add_tapes (path, 0);
+      free (path);
+      free (entry[i]);
     }
-  else if (dos_fat (data))
+  free (entry);
+}
+
+static void
+classify_corpus (int threads)
+{
+  pthread_t *thread;
+  int i, started;
+
+  if (threads <= 0)
+    threads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+  if ((size_t)threads > ntapes)
+    threads = ntapes;
+
+  tape_image_error = bad_tape_hook;
+  if (!json_flag)
+    printf ("file,format,tracks,endian,container,ansi,records,error\n");
+
+  thread = malloc (threads * sizeof *thread);
+  if (thread == NULL)
     {
-      printf ("FAT file system");
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
     }
-  else if (unix_cpio (data))
+  for (started = 0; started < threads; started++)
+    if (pthread_create (&thread[started], NULL, corpus_worker, NULL) != 0)
+      break;
+  if (started == 0)
+    corpus_worker (NULL);
+  for (i = 0; i < started; i++)
+    pthread_join (thread[i], NULL);
+  free (thread);
+}
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "Usage: %s [-eut] < image\n", name);
+  fprintf (stderr, "       %s -a [-t] [image]\n", name);
+  fprintf (stderr, "       %s [-j] [-n threads] image|directory...\n", name);
+  exit (1);
+}
+
+int main (int argc, char **argv)
+{
+  const char *format;
+  uint32_t len;
+  uint8_t *data;
+  int opt, threads = 0;
+  FILE *f;
+
+  while ((opt = getopt (argc, argv, "aetujn:")) != -1)
+    switch (opt)
+      {
+      case 'a':
+        all_flag = 1;
+        break;
+      case 'e':
+        eot_flag = 1;
+        break;
+      case 'u':
+        unknown_flag = 1;
+        break;
+      case 't':
+        tape_format_flag = 1;
+        break;
+      case 'j':
+        json_flag = 1;
+        break;
+      case 'n':
+        threads = atoi (optarg);
+        break;
+      default:
+        usage (argv[0]);
+      }
+
+  if (optind < argc && !all_flag)
     {
-      printf ("Unix cpio");
+      for (; optind < argc; optind++)
+        add_tapes (argv[optind], 1);
+      classify_corpus (threads);
+      return 0;
     }
-#if 0
-  else if (asciz_text (data, len))
+
+  if (all_flag)
     {
-      printf ("Raw text");
+      f = stdin;
+      if (optind + 1 == argc)
+        f = fopen (argv[optind], "rb");
+      else if (optind < argc)
+        usage (argv[0]);
+      if (f == NULL)
+        {
+          fprintf (stderr, "%s: %s\n", argv[optind], strerror (errno));
+          exit (1);
+        }
+      reset_state (f);
+      classify_files ();
+      return 0;
     }
-#endif
+
+  reset_state (stdin);
+  data = first_record (&len);
+  format = classify (data, len);
+  if (format != NULL)
+    printf ("%s", format);
   else
     {
       printf ("Unknown");
@@ -500,11 +942,11 @@ int main (int argc, char **argv)
         {
           printf ("\nRecord size: %u %x\n", len, len);
           hexdump (data, len);
-          len = read_record (stdin, image, sizeof image);
+          len = read_record (tape, image, IMAGE_SIZE);
           printf ("Second size: %u %x\n", len, len);
           if ((len & 0x80000000) == 0)
             hexdump (data, len);
-          len = read_record (stdin, image, sizeof image);
+          len = read_record (tape, image, IMAGE_SIZE);
           printf ("Third size: %u %x\n", len, len);
           if ((len & 0x80000000) == 0)
             hexdump (data, len);
@@ -515,20 +957,7 @@ int main (int argc, char **argv)
     printf (" (ANSI label)");
 
   if (tape_format_flag)
-    {
-      printf ("  [");
-      if (track_7)
-        printf ("7-track, ");
-      if (track_9)
-        printf ("9-track, ");
-      printf ("%s-endian",
-              big_endian ? "big" : "little");
-      if (e11)
-        printf (", E11");
-      if (simh)
-        printf (", SIMH");
-      printf ("]");
-    }
+    print_tape_format ();
 
   if (eot_flag)
     check_eot ();
@@ -20,6 +20,7 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -54,6 +55,7 @@ static char** file_argv;
 static int tape_frames;
 static int tape_bpw; /* Tape frames per word. */
 static int tape_bpi;
+static int threads;
 
 /* Convert a WAITS date to a struct timeval. */
 static void
@@ -335,23 +337,212 @@ open_file (char *name, char *ext, char *prj, char *prg)
 	     file_path, strerror (errno));
 }
 
-static word_t
-file_size (char *name)
+/* Files to write are read ahead by worker threads, each into its
+   own buffer.  The words are split into the pieces each record will
+   hold, and the checksum of every piece is computed, so that all that
+   is left to do when writing is to add the record headers.  Files are
+   taken in order, and at most AHEAD of them are read before they are
+   written. */
+#define AHEAD 16
+
+struct input {
+  char *name;
+  int error;			/* From fopen, or 0. */
+  int stat_error;		/* From fstat, or 0. */
+  time_t mtime;
+  word_t *words;
+  size_t size;
+  size_t allocated;
+  word_t *sums;			/* Checksum of each record's data. */
+  int records;
+  int sums_size;
+  int ready;
+};
+
+static struct input input[AHEAD];
+static int inputs_taken, inputs_written;
+static pthread_mutex_t input_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t input_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t *workers;
+
+/* Words of file data in a record, where the data starts at offset.
+   Set *done if this is the last record of the file. */
+static int
+record_words (int offset, size_t left, int *done)
+{
+  int max, size;
+
+  max = iover < 3 ? MAX800 : MAX6250 - LMEDER;
+  max -= 2; /* Leave room for length and checksum words. */
+
+  size = max - offset;
+  *done = (size_t)size > left;
+  if (*done)
+    size = left;
+  return size;
+}
+
+static void
+prepare_input (struct input *in)
 {
-  word_t size = 0;
-  FILE *f = fopen (name, "rb");
+  struct word_stream s;
+  struct stat st;
+  const word_t *p;
+  word_t sum;
+  size_t left;
+  int offset, size, done, i;
+  FILE *f;
+
+  f = fopen (in->name, "rb");
   if (f == NULL)
     {
-      fprintf (stderr, "\nError opening input file %s: %s",
-	       name, strerror (errno));
-      exit (1);
+      in->error = errno;
+      return;
+    }
+  in->error = 0;
+  in->stat_error = fstat (fileno (f), &st) == -1 ? errno : 0;
+  in->mtime = in->stat_error ? 0 : st.st_mtime;
+
+  /* Reading a directory would never end. */
+  if (!in->stat_error && !S_ISREG (st.st_mode))
+    {
+      in->error = S_ISDIR (st.st_mode) ? EISDIR : EINVAL;
+      fclose (f);
+      return;
     }
 
-  while (get_word (f) != -1)
-    size++;
+  /* Mapped, since stdio locks for every octet with threads about. */
+  init_word_stream (&s, f, input_word_format);
+  map_word_stream (&s);
+  in->size = stream_get_all_words (&s, &in->words, &in->allocated);
+  free_word_stream (&s);
   fclose (f);
-  fprintf (debug, "\nFile %s size: %lld", name, size);
-  return size;
+
+  /* The pieces are the same as write_file takes. */
+  in->records = 0;
+  offset = iover >= 3 ? 043 : 021;
+  p = in->words;
+  left = in->size;
+  do
+    {
+      size = record_words (offset, left, &done);
+      for (sum = 0, i = 0; i < size; i++)
+	sum ^= p[i];
+      if (in->records == in->sums_size)
+	{
+	  in->sums_size = in->sums_size == 0 ? 64 : 2 * in->sums_size;
+	  in->sums = realloc (in->sums, in->sums_size * sizeof *in->sums);
+	  if (in->sums == NULL)
+	    {
+	      fprintf (stderr, "Out of memory.\n");
+	      exit (1);
+	    }
+	}
+      in->sums[in->records++] = sum;
+      p += size;
+      left -= size;
+      if (iover < 3)
+	offset = 0;
+    }
+  while (!done);
+}
+
+static void *
+worker (void *arg)
+{
+  struct input *in;
+  int n;
+
+  (void)arg;
+  pthread_mutex_lock (&input_lock);
+  for (;;)
+    {
+      while (inputs_taken < file_argc && inputs_taken >= inputs_written + AHEAD)
+	pthread_cond_wait (&input_cond, &input_lock);
+      if (inputs_taken == file_argc)
+	break;
+      n = inputs_taken++;
+      in = &input[n % AHEAD];
+      in->name = file_argv[n];
+      pthread_mutex_unlock (&input_lock);
+
+      prepare_input (in);
+
+      pthread_mutex_lock (&input_lock);
+      in->ready = 1;
+      pthread_cond_broadcast (&input_cond);
+    }
+  pthread_mutex_unlock (&input_lock);
+  return NULL;
+}
+
+static void
+start_workers (void)
+{
+  int i;
+
+  if (threads <= 0)
+    threads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+
+  workers = malloc (threads * sizeof *workers);
+  if (workers == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  for (i = 0; i < threads; i++)
+    if (pthread_create (&workers[i], NULL, worker, NULL) != 0)
+      break;
+  threads = i;
+}
+
+/* Get the next file to write, waiting for it to be read.  Without
+   workers, read it here. */
+static struct input *
+next_input (void)
+{
+  struct input *in = &input[inputs_written % AHEAD];
+
+  if (threads == 0)
+    {
+      in->name = file_argv[inputs_written];
+      prepare_input (in);
+      return in;
+    }
+
+  pthread_mutex_lock (&input_lock);
+  while (!in->ready)
+    pthread_cond_wait (&input_cond, &input_lock);
+  pthread_mutex_unlock (&input_lock);
+  return in;
+}
+
+/* Done writing a file; let its buffer be used for another. */
+static void
+input_written (struct input *in)
+{
+  pthread_mutex_lock (&input_lock);
+  in->ready = 0;
+  inputs_written++;
+  pthread_cond_broadcast (&input_cond);
+  pthread_mutex_unlock (&input_lock);
+}
+
+static void
+finish_workers (void)
+{
+  int i;
+
+  for (i = 0; i < threads; i++)
+    pthread_join (workers[i], NULL);
+  free (workers);
+  for (i = 0; i < AHEAD; i++)
+    {
+      free (input[i].words);
+      free (input[i].sums);
+    }
 }
 
 /* Compute the rotated checksum for IOVER3 header/trailer. */
@@ -367,9 +558,7 @@ rotchk (word_t x)
 static void
 write_block (word_t *data, int size)
 {
-  int i;
-  for (i = 0; i < size; i++)
-    write_word (output, *data++);
+  write_words (output, data, size);
 }
 
 static word_t
@@ -652,33 +841,16 @@ write_header (FILE *f, word_t type)
   write_word (f, checksum);
 }
 
-static int
-read_block (FILE *f, word_t *data, int offset)
-{
-  int i, max, size = 0;
-  word_t word;
-
-  max = iover < 3 ? MAX800 : MAX6250 - LMEDER;
-  max -= 2; /* Leave room for length and checksum words. */
-
-  for (i = offset; i < max; i++)
-    {
-      word = get_word (f);
-      if (word == -1)
-	return size;
-      data[i] = word;
-      size++;
-    }
-  
-  return size;
-}
-
 static void
-write_data (FILE *f, FILE *input, int offset, word_t start)
+write_data (FILE *f, struct input *in, const word_t **data, int record,
+	    int offset, word_t start, int *done)
 {
-  int i, length;
-  length = read_block (input, block, offset);
-  length += offset;
+  int i, length, size;
+
+  size = record_words (offset, in->size - (*data - in->words), done);
+  memcpy (block + offset, *data, size * sizeof (word_t));
+  *data += size;
+  length = offset + size;
   if (iover >= 3)
     {
       block[027] = tape_feet ();
@@ -686,13 +858,16 @@ write_data (FILE *f, FILE *input, int offset, word_t start)
       length += LMEDER;
       block[length - 1] = PRMEND;
     }
+
+  /* The data was summed when it was read. */
+  checksum = in->sums[record];
+  for (i = 0; i < offset; i++)
+    checksum ^= block[i];
+  for (i = offset + size; i < length; i++)
+    checksum ^= block[i];
+
   write_word (f, length | start);
-  checksum = 0;
-  for (i = 0; i < length; i++)
-    {
-      write_word (f, block[i]);
-      checksum ^= block[i];
-    }
+  write_words (f, block, length);
   write_word (f, checksum);
   if (iover >= 3)
     block[033] -= length - offset; /* Update file words left. */
@@ -701,24 +876,25 @@ write_data (FILE *f, FILE *input, int offset, word_t start)
 }
 
 static void
-write_file (FILE *f, char *name)
+write_file (FILE *f, struct input *in)
 {
   char nam[18], ext[18], prj[18], prg[18];
+  const word_t *data = in->words;
   word_t timestamp;
-  struct stat st;
-  int offset = 021;
-  FILE *input = fopen (name, "rb");
-  if (input == NULL)
+  int offset = 021, record = 0, done;
+  char *name = in->name;
+
+  if (in->error)
     {
       fprintf (stderr, "\nError opening input file %s: %s",
-	       name, strerror (errno));
+	       name, strerror (in->error));
       return;
     }
 
-  if (fstat (fileno (input), &st) == -1)
+  if (in->stat_error)
     fprintf (stderr, "\nError calling stat on file %s: %s",
-	     name, strerror (errno));
-  timestamp = waits_timestamp (st.st_mtime);
+	     name, strerror (in->stat_error));
+  timestamp = waits_timestamp (in->mtime);
 
   unmangle (name, nam, ext, prj, prg);
   block[0] = ascii_to_sixbit ("DSK   ");
@@ -729,9 +905,10 @@ write_file (FILE *f, char *name)
     block[2] |= (timestamp >> 21) & 070000LL;
   block[4] = ascii_to_sixbit (prj) | ascii_to_sixbit (prg) >> 18;
   fprintf (debug, "\nFILE: %s.%s[%s,%s]", nam, ext, prj, prg);
+  fprintf (debug, "\nFile %s size: %ld", name, (long)in->size);
 
   block[005] = 0; //ddloc location of first block
-  block[006] = file_size (name);
+  block[006] = in->size;
   block[007] = 0; //dreftm, referenced
   block[010] = 0; //ddmptm, dump time
   block[011] = 1; //dgrp1r, group 1
@@ -762,15 +939,15 @@ write_file (FILE *f, char *name)
     }
 
   tape_frames += 3 * tape_bpi; /* Tape mark. */
-  write_data (f, input, offset,
-	      (((01000000 - iover) << 18) & 0777777000000LL) | START_FILE);
+  write_data (f, in, &data, record++, offset,
+	      (((01000000 - iover) << 18) & 0777777000000LL) | START_FILE,
+	      &done);
   if (iover >= 3)
     block[022] = ascii_to_sixbit ("CON   ") | iover;
   else
     offset = 0;
-  while (!feof (input))
-    write_data (f, input, offset, START_RECORD);
-  fclose (input);
+  while (!done)
+    write_data (f, in, &data, record++, offset, START_RECORD, &done);
 }
 
 static void
@@ -784,10 +961,23 @@ write_tape (FILE *f)
   if (f == NULL)
     f = stdout;
 
+  /* Check the names before the workers start reading the files. */
+  for (i = 0; i < file_argc; i++)
+    {
+      char nam[18], ext[18], prj[18], prg[18];
+      unmangle (file_argv[i], nam, ext, prj, prg);
+    }
+
   tape_frames = 0;
   write_header (f, HEAD);
+  start_workers ();
   for (i = 0; i < file_argc; i++)
-    write_file (f, file_argv[i]);
+    {
+      struct input *in = next_input ();
+      write_file (f, in);
+      input_written (in);
+    }
+  finish_workers ();
   tape_frames += 3 * tape_bpi; /* Tape mark. */
   write_header (f, TAIL);
   flush_word (f);
@@ -797,7 +987,7 @@ static void
 usage (const char *x)
 {
   fprintf (stderr,
-	   "Usage: %s -c|-t|-x [-v789] [-Wformat] [-Cdir] [-f file]\n", x);
+	   "Usage: %s -c|-t|-x [-v789] [-Wformat] [-Cdir] [-f file] [-n threads]\n", x);
   usage_word_format ();
   exit (1);
 }
@@ -828,7 +1018,7 @@ main (int argc, char **argv)
   list = stdout;
   info = debug = stderr;
 
-  while ((opt = getopt (argc, argv, "ctvx123789f:W:C:")) != -1)
+  while ((opt = getopt (argc, argv, "ctvx123789f:n:W:C:")) != -1)
     {
       switch (opt)
 	{
@@ -840,6 +1030,10 @@ main (int argc, char **argv)
 	    }
 	  tape_name = optarg;
 	  break;
+	case 'n':
+	  /* Threads reading files to write. */
+	  threads = atoi (optarg);
+	  break;
 	case 't':
 	  if (process_tape != NULL)
 	    {
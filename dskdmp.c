@@ -13,11 +13,21 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
+#include <time.h>
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 #include "dis.h"
+#include "mkdirs.h"
 
-#define RP06_IMAGE_SIZE 316047360
 #define SECTOR_WORDS 128
 #define BLOCK_WORDS 1024
 #define BLOCK_SECTORS (BLOCK_WORDS / SECTOR_WORDS)
@@ -31,7 +41,23 @@
 #define UNIGFL 0000024000000LL
 #define UNDUMP 0400000000000LL
 
-word_t image[RP06_IMAGE_SIZE / 8 + 1];
+/* TUT.  The header words are as show_tut prints them.  LTIBLK and
+   TUTBYT are not taken from the ITS sources, only chosen so the
+   entries fit in NTUTBL blocks, so the audit is experimental. */
+#define QFRSTB 4				/* First block in the TUT. */
+#define QLASTB 5				/* Last block in the TUT, plus one. */
+#define LTIBLK 8				/* Words before the entries. */
+#define TUTBYT 3				/* Bits per entry. */
+#define TUTEPW (36 / TUTBYT)			/* Entries per word. */
+#define TUTLK ((1 << TUTBYT) - 1)		/* Locked out. */
+
+#define LEFT 0777777000000LL
+#define RIGHT 0777777LL
+
+/* The pack image, mapped into memory.  Each word is eight octets,
+   little endian. */
+const unsigned char *pack;
+size_t pack_size;
 int blocks;
 int mblks;
 int xblks;
@@ -45,51 +71,65 @@ int tutblk;
 int mdnuds;
 char *type;
 
-static int
-get_byte (FILE *f)
-{
-  int c = fgetc (f);
-  return c == EOF ? -1 : c;
-}
+/* Extracting files, or auditing the TUT. */
+static int extract = 0;
+static int audit = 0;
+static int threads;
+static word_t mfd[BLOCK_WORDS];
+static int next_ufd;
+static int directories, files;
+static pthread_mutex_t mfd_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static word_t get_disk_word (FILE *f)
+static void
+map_pack (const char *name)
 {
-  int i, x;
-  word_t w = 0;
+  struct stat st;
+  void *map;
+  int fd;
 
-  for (i = 0; i < 8; i++)
+  fd = open (name, O_RDONLY);
+  if (fd == -1 || fstat (fd, &st) == -1)
     {
-      x = get_byte (f);
-      if (x == -1)
-	return -1;
+      fprintf (stderr, "Error opening %s: %s\n", name, strerror (errno));
+      exit (1);
+    }
 
-      w += (word_t)x << (i * 8);
+  pack_size = st.st_size;
+  if (pack_size > 0)
+    {
+      map = mmap (NULL, pack_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED)
+	{
+	  fprintf (stderr, "Error mapping %s: %s\n", name, strerror (errno));
+	  exit (1);
+	}
+      pack = map;
     }
+  close (fd);
 
-  return w;
+  blocks = pack_size / (8 * BLOCK_WORDS);
 }
 
+/* Decode a block from the pack into buffer.  Past the end of the
+   image, the words are zero. */
 static word_t *
-get_block (int block)
+get_block (int block, word_t *buffer)
 {
   int cylinder = block / nblksc;
   int sector = cylinder * nsecsc;
-  return &image[sector * SECTOR_WORDS
-		+ (block % nblksc) * BLOCK_WORDS];
-}
+  size_t offset = 8 * ((size_t)sector * SECTOR_WORDS
+		       + (size_t)(block % nblksc) * BLOCK_WORDS);
+  size_t n = 0;
 
-static int read_block (FILE *f, word_t *buffer)
-{
-  int i;
-
-  for (i = 0; i < BLOCK_WORDS; i++)
+  if (block >= 0 && offset < pack_size)
     {
-      buffer[i] = get_disk_word (f);
-      if (buffer[i] == -1)
-	return -1;
+      n = (pack_size - offset) / 8;
+      if (n > BLOCK_WORDS)
+	n = BLOCK_WORDS;
+      unpack_data8_words (pack + offset, buffer, n);
     }
-
-  return 0;
+  memset (buffer + n, 0, (BLOCK_WORDS - n) * sizeof (word_t));
+  return buffer;
 }
 
 static void
@@ -105,7 +145,8 @@ show_disk (void)
 static void
 show_tut (void)
 {
-  word_t *tut = get_block (tutblk);
+  word_t buffer[BLOCK_WORDS];
+  word_t *tut = get_block (tutblk, buffer);
   char str[7];
 
   fprintf (stderr, "\n--- TUT info ---\n");
@@ -139,6 +180,7 @@ ildb (word_t **w, int *p)
 static void
 print_blocks (int start, int end, int end_words)
 {
+  word_t buffer[BLOCK_WORDS];
   int i, j, n = 1024;
 
   return;
@@ -149,7 +191,7 @@ print_blocks (int start, int end, int end_words)
 	n = end_words;
       for (j = 0; j < n; j++)
 	{
-	  word_t w = get_block (i)[j];
+	  word_t w = get_block (i, buffer)[j];
 	  putchar ((w >> 29) & 0177);
 	  putchar ((w >> 22) & 0177);
 	  putchar ((w >> 15) & 0177);
@@ -231,7 +273,8 @@ static void
 show_ufd (int index, char *name)
 {
   int b = (index - 02000 + 2*mdnuds) / 2;
-  word_t *ufd = get_block (b);
+  word_t buffer[BLOCK_WORDS];
+  word_t *ufd = get_block (b, buffer);
   char str[7];
   int i, n;
 
@@ -300,10 +343,10 @@ show_ufd (int index, char *name)
 static void
 show_mfd (void)
 {
-  word_t *mfd = get_block (mfdblk);
   char str[7];
   int i;
 
+  get_block (mfdblk, mfd);
   if (mfd[5] != 0551646164416)
     {
       fprintf (stderr, "MFDCLB\n");
@@ -322,6 +365,9 @@ show_mfd (void)
   fprintf (stderr, "MDNUDS = %o\n", mdnuds);
   fprintf (stderr, "LMIBLK = %llo\n", mfd[7]);
 
+  if (extract || audit)
+    return;
+
   for (i = mfd[1]; i < BLOCK_WORDS; i += 2)
     {
       sixbit_to_ascii (mfd[i], str);
@@ -329,33 +375,477 @@ show_mfd (void)
     }
 }
 
-int
-main (int argc, char **argv)
+static void
+unix_time (struct timeval *tv, word_t t)
+{
+  struct tm tm;
+  int seconds = (t & RIGHT) / 2;
+  int date = (t >> 18);
+
+  tm.tm_sec = seconds % 60;
+  tm.tm_min = (seconds / 60) % 60;
+  tm.tm_hour = seconds / 3600;
+  tm.tm_mday = (date & 037);
+  tm.tm_mon = ((date & 0740) >> 5) - 1;
+  tm.tm_year = (date & 0777000) >> 9;
+  tm.tm_isdst = 0;
+
+  tv->tv_sec = mktime (&tm);
+  tv->tv_usec = (t & 1) * 500000L;
+}
+
+static int
+descriptor_byte (word_t **d, int *o, word_t *end)
+{
+  return *d < end ? ildb (d, o) : 0;
+}
+
+/* Follow the descriptor of a file, like show_blocks, and put its
+   block numbers in *list, which holds *size and is enlarged as
+   needed.  Return the number of blocks. */
+static int
+file_blocks (word_t *ufd, int undscp, int **list, int *size)
+{
+  word_t *d, *end = ufd + BLOCK_WORDS;
+  int o, b = 0, n, i, count = 0;
+  int *p;
+
+  d = &ufd[11+undscp/6];
+  o = undscp % 6;
+
+  for (;;)
+    {
+      n = descriptor_byte (&d, &o, end);
+      if (n == 0)
+	return count;
+
+      if (count + 12 > *size)
+	{
+	  *size = *size == 0 ? 1024 : 2 * *size;
+	  p = realloc (*list, *size * sizeof *p);
+	  if (p == NULL)
+	    {
+	      fprintf (stderr, "Out of memory.\n");
+	      exit (1);
+	    }
+	  *list = p;
+	}
+
+      if (n <= 12)
+	for (i = 0; i < n; i++)
+	  (*list)[count++] = b++;
+      else if (n <= 30)
+	{
+	  b += n - 12;
+	  (*list)[count++] = b++;
+	}
+      else if (n != 037)
+	{
+	  b = (n & 037) << 12;
+	  b += descriptor_byte (&d, &o, end) << 6;
+	  b += descriptor_byte (&d, &o, end);
+	  (*list)[count++] = b++;
+	}
+    }
+}
+
+/* Buffers for one thread extracting files. */
+struct extractor {
+  word_t ufd[BLOCK_WORDS];
+  word_t *words;
+  size_t words_size;
+  int *list;
+  int list_size;
+};
+
+/* Write file i in the UFD to name.ext in a directory named like the
+   UFD.  The words are decoded straight from the mapped blocks. */
+static void
+extract_file (struct extractor *x, int i)
 {
-  word_t *buffer;
+  word_t *ufd = x->ufd;
+  struct timeval tv[2];
+  struct word_stream s;
+  char path[30];
+  size_t length;
+  int j, n, last;
+  word_t *p;
   FILE *f;
 
-  if (argc != 2)
+  n = file_blocks (ufd, ufd[i+2] & 017777, &x->list, &x->list_size);
+  if ((size_t)n * BLOCK_WORDS > x->words_size)
     {
-      fprintf (stderr, "Usage: %s <file>\n", argv[0]);
-      exit (1);
+      x->words_size = (size_t)n * BLOCK_WORDS;
+      p = realloc (x->words, x->words_size * sizeof *p);
+      if (p == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      x->words = p;
     }
+  for (j = 0; j < n; j++)
+    get_block (x->list[j], x->words + j * BLOCK_WORDS);
+
+  /* The words in the last block, where 0 means all of them. */
+  last = (ufd[i+2] >> 24) & 01777;
+  length = n == 0 ? 0 : (size_t)(n - 1) * BLOCK_WORDS
+    + (last == 0 ? BLOCK_WORDS : last);
+
+  weenixpath (path, ufd[2], ufd[i], ufd[i+1]);
+  mkdirs (path);
+  f = fopen (path, "wb");
+  if (f == NULL)
+    {
+      fprintf (stderr, "Error opening output file %s: %s\n",
+	       path, strerror (errno));
+      return;
+    }
+  init_word_stream (&s, f, output_word_format);
+  stream_write_words (&s, x->words, length);
+  stream_flush_word (&s);
+  free_word_stream (&s);
+  fclose (f);
+
+  unix_time (&tv[0], ufd[i+4] & LEFT);
+  unix_time (&tv[1], ufd[i+3]);
+  utimes (path, tv);
+}
 
-  output_file = stdout;
+/* Extract the files in the UFD at the given index in the MFD.  Links
+   and files being written or deleted are left out. */
+static int
+extract_ufd (struct extractor *x, int index)
+{
+  int b = (index - 02000 + 2*mdnuds) / 2;
+  word_t *ufd = get_block (b, x->ufd);
+  int i, n = 0;
+
+  for (i = ufd[1]; i >= 0 && i + 5 <= BLOCK_WORDS; i += 5)
+    {
+      if (ufd[i] == 0 || (ufd[i+2] & (UNLINK | UNIGFL)))
+	continue;
+      extract_file (x, i);
+      n++;
+    }
+  return n;
+}
 
-  f = fopen (argv[1], "rb");
+static void *
+worker (void *arg)
+{
+  struct extractor *x;
+  int i, n;
+
+  (void)arg;
+  x = calloc (1, sizeof *x);
+  if (x == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
 
-  buffer = image;
-  blocks = 0;
   for (;;)
     {
-      int n = read_block (f, buffer);
-      if (n == -1)
+      pthread_mutex_lock (&mfd_lock);
+      i = next_ufd;
+      next_ufd += 2;
+      pthread_mutex_unlock (&mfd_lock);
+      if (i >= BLOCK_WORDS)
 	break;
-      buffer += BLOCK_WORDS;
-      blocks++;
+      if (mfd[i] == 0)
+	continue;
+
+      n = extract_ufd (x, i);
+      pthread_mutex_lock (&mfd_lock);
+      directories++;
+      files += n;
+      pthread_mutex_unlock (&mfd_lock);
+    }
+
+  free (x->words);
+  free (x->list);
+  free (x);
+  return NULL;
+}
+
+/* Extract every UFD in the MFD, each on one of a pool of threads. */
+static void
+extract_pack (void)
+{
+  pthread_t *workers;
+  int i, n;
+
+  n = threads;
+  if (n <= 0)
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n <= 0)
+    n = 1;
+  workers = malloc (n * sizeof *workers);
+  if (workers == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+
+  next_ufd = mfd[1] < 0 ? BLOCK_WORDS : mfd[1];
+  for (i = 0; i < n; i++)
+    if (pthread_create (&workers[i], NULL, worker, NULL) != 0)
+      break;
+  if (i == 0)
+    worker (NULL);
+  n = i;
+  for (i = 0; i < n; i++)
+    pthread_join (workers[i], NULL);
+  free (workers);
+
+  fprintf (stderr, "\n%d files extracted from %d directories.\n",
+	   files, directories);
+}
+
+/* Block bitmaps for the audit, with 64 blocks to an element. */
+typedef unsigned long long bitmap_t;
+
+static bitmap_t *
+new_bitmap (size_t n)
+{
+  bitmap_t *bitmap = calloc (n, sizeof *bitmap);
+  if (bitmap == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  return bitmap;
+}
+
+/* Mark a block as used, and as used again if it already was. */
+static void
+use_block (bitmap_t *used, bitmap_t *multi, int block)
+{
+  bitmap_t bit = 1ULL << (block % 64);
+  multi[block / 64] |= used[block / 64] & bit;
+  used[block / 64] |= bit;
+}
+
+/* Convert a SIXBIT name to ASCII without the trailing spaces. */
+static char *
+trimmed_name (word_t sixbit, char *str)
+{
+  char *p;
+
+  sixbit_to_ascii (sixbit, str);
+  for (p = str + strlen (str); p > str && p[-1] == ' '; p--)
+    ;
+  *p = 0;
+  return str;
+}
+
+/* Print the blocks set in a bitmap as ranges, and return how many
+   there are. */
+static int
+print_bitmap (const char *what, const bitmap_t *bitmap, size_t n)
+{
+  int block, start = -1, count = 0;
+
+  for (block = 0; (size_t)block <= 64 * n; block++)
+    {
+      if ((size_t)block < 64 * n && (bitmap[block / 64] >> (block % 64)) & 1)
+	{
+	  if (start == -1)
+	    {
+	      if (count == 0)
+		fprintf (stderr, "%s:", what);
+	      start = block;
+	    }
+	  count++;
+	  continue;
+	}
+      if (start == -1)
+	continue;
+      if (start == block - 1)
+	fprintf (stderr, " %o", start);
+      else
+	fprintf (stderr, " %o-%o", start, block - 1);
+      start = -1;
+    }
+
+  if (count > 0)
+    fputc ('\n', stderr);
+  return count;
+}
+
+/* Check the TUT against the blocks the directories use.  Every file's
+   descriptor is followed to mark its blocks in a bitmap, along with
+   the MFD, TUT, and UFD blocks themselves.  The TUT entries are
+   turned into bitmaps too, and then compared with one pass of bitwise
+   operations.  Only the blocks from QFRSTB up to QLASTB are in the
+   TUT, so only those are compared.  Return the number of problems
+   found. */
+static int
+audit_tut (void)
+{
+  word_t ufd[BLOCK_WORDS], *tut;
+  bitmap_t *used, *multi, *tut_used, *locked, *leaked, *unrecorded;
+  bitmap_t *described;
+  size_t n = (nblks + 63) / 64, k;
+  int *list = NULL, size = 0;
+  int i, j, m, b, problems = 0;
+  word_t first, last;
+  char str[7], str2[7], str3[7];
+  word_t entry;
+
+  used = new_bitmap (n);
+  multi = new_bitmap (n);
+  tut_used = new_bitmap (n);
+  locked = new_bitmap (n);
+  leaked = new_bitmap (n);
+  unrecorded = new_bitmap (n);
+  described = new_bitmap (n);
+
+  fprintf (stderr, "\n--- TUT audit (experimental) ---\n");
+
+  use_block (used, multi, mfdblk);
+  for (i = 0; i < ntutbl; i++)
+    use_block (used, multi, tutblk + i);
+
+  for (i = mfd[1]; i >= 0 && i < BLOCK_WORDS; i += 2)
+    {
+      if (mfd[i] == 0)
+	continue;
+      b = (i - 02000 + 2*mdnuds) / 2;
+      if (b < 0 || b >= nblks)
+	{
+	  fprintf (stderr, "Out of range: UFD %s in block %o\n",
+		   trimmed_name (mfd[i], str), b);
+	  problems++;
+	  continue;
+	}
+      use_block (used, multi, b);
+
+      get_block (b, ufd);
+      for (j = ufd[1]; j >= 0 && j + 5 <= BLOCK_WORDS; j += 5)
+	{
+	  if (ufd[j] == 0 || (ufd[j+2] & UNLINK))
+	    continue;
+	  m = file_blocks (ufd, ufd[j+2] & 017777, &list, &size);
+	  while (m-- > 0)
+	    {
+	      b = list[m];
+	      if (b >= 0 && b < nblks)
+		{
+		  use_block (used, multi, b);
+		  continue;
+		}
+	      fprintf (stderr, "Out of range: block %o in %s; %s %s\n", b,
+		       trimmed_name (mfd[i], str), trimmed_name (ufd[j], str2),
+		       trimmed_name (ufd[j+1], str3));
+	      problems++;
+	    }
+	}
+    }
+  free (list);
+
+  tut = malloc (ntutbl * BLOCK_WORDS * sizeof *tut);
+  if (tut == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  for (i = 0; i < ntutbl; i++)
+    get_block (tutblk + i, tut + i * BLOCK_WORDS);
+  first = tut[QFRSTB];
+  last = tut[QLASTB];
+  if (first > last || last > (word_t)nblks
+      || LTIBLK + (last - first + TUTEPW - 1) / TUTEPW
+	 > (word_t)ntutbl * BLOCK_WORDS)
+    {
+      fprintf (stderr, "Bad TUT: QFRSTB %llo, QLASTB %llo\n", first, last);
+      problems++;
+      first = last = 0;
+    }
+  for (b = first; b < (int)last; b++)
+    {
+      entry = tut[LTIBLK + (b - first) / TUTEPW];
+      entry >>= 36 - TUTBYT * ((b - first) % TUTEPW + 1);
+      entry &= TUTLK;
+      described[b / 64] |= 1ULL << (b % 64);
+      if (entry != 0)
+	tut_used[b / 64] |= 1ULL << (b % 64);
+      if (entry == TUTLK)
+	locked[b / 64] |= 1ULL << (b % 64);
+    }
+  free (tut);
+
+  for (k = 0; k < n; k++)
+    {
+      leaked[k] = tut_used[k] & ~locked[k] & ~used[k];
+      unrecorded[k] = used[k] & described[k] & ~tut_used[k];
+    }
+
+  problems += print_bitmap ("Doubly allocated", multi, n);
+  problems += print_bitmap ("Leaked", leaked, n);
+  problems += print_bitmap ("Used but free in TUT", unrecorded, n);
+  fprintf (stderr, "%d problems.\n", problems);
+
+  free (used);
+  free (multi);
+  free (tut_used);
+  free (locked);
+  free (leaked);
+  free (unrecorded);
+  free (described);
+  return problems;
+}
+
+static void
+usage (const char *x)
+{
+  fprintf (stderr, "Usage: %s [-a|-x] [-Cdir] [-Wformat] [-n threads] <file>\n", x);
+  usage_word_format ();
+  exit (1);
+}
+
+int
+main (int argc, char **argv)
+{
+  char *directory = NULL;
+  int opt;
+
+  output_word_format = &its_word_format;
+
+  while ((opt = getopt (argc, argv, "axn:C:W:")) != -1)
+    {
+      switch (opt)
+	{
+	case 'a':
+	  audit = 1;
+	  break;
+	case 'x':
+	  extract = 1;
+	  break;
+	case 'n':
+	  /* Threads extracting directories. */
+	  threads = atoi (optarg);
+	  break;
+	case 'C':
+	  directory = optarg;
+	  break;
+	case 'W':
+	  if (parse_output_word_format (optarg))
+	    usage (argv[0]);
+	  break;
+	default:
+	  usage (argv[0]);
+	}
     }
 
+  if (argc != optind + 1)
+    usage (argv[0]);
+
+  output_file = stdout;
+
+  map_pack (argv[optind]);
+
   fprintf (stderr, "%o blocks in image\n", blocks);
 
   switch (blocks)
@@ -391,5 +881,21 @@ main (int argc, char **argv)
   show_tut();
   show_mfd();
 
+  if (extract)
+    {
+      if (directory != NULL
+	  && ((mkdir (directory, 0777) == -1 && errno != EEXIST)
+	      || chdir (directory) == -1))
+	{
+	  fprintf (stderr, "Error entering directory %s: %s\n",
+		   directory, strerror (errno));
+	  exit (1);
+	}
+      extract_pack ();
+    }
+
+  if (audit && audit_tut () != 0)
+    exit (1);
+
   return 0;
 }
@@ -61,6 +61,14 @@ main (int argc, char **argv)
 
   init_memory (&memory);
 
+  /* Without files, read standard input. */
+  if (optind == argc)
+    {
+      if (!input_file_format)
+        guess_input_file_format (file);
+      input_file_format->read (file, &memory, 0);
+    }
+
   while (optind < argc)
     {
       fprintf (stderr, "File: %s\n", argv[optind]);
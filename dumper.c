@@ -21,12 +21,19 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <string.h>
+#include <fnmatch.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include "dis.h"
 #include "mkdirs.h"
 
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#define X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 /* Record types. */
 #define DATA  0  /* Contents of file page. */
 #define TPHD  1  /* Saveset header. */
@@ -52,8 +59,47 @@ static FILE *list;
 static FILE *info;
 static FILE *debug;
 
-static FILE *output;
+/* A file being extracted.  The tape is read on the main thread, and
+   each file is collected in a job.  A pool of threads takes the jobs
+   from a queue, and converts and writes them.  Jobs for the same path
+   are written one after the other in tape order, so the last copy on
+   the tape is the one left. */
+struct job {
+  char path[100];
+  struct timeval tv[2];
+  word_t *words;
+  size_t size, used;
+  long number;
+};
+
+/* The queue holds at most this many jobs, and this many words unless
+   it's just one job. */
+#define QUEUE 16
+#define QUEUE_WORDS (4 * 1024 * 1024)
+
+static struct job *job;
+static struct job *queue[QUEUE];
+static int queue_head, queue_count, queue_done;
+static size_t queue_words;
+static long jobs_queued;
+/* The job each worker has, for checking paths. */
+static struct job **writing;
+static int writers;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t *workers;
+static int threads;
+
 static char file_path[100];
+/* The file the records being read belong to, for reporting. */
+static char record_file[100];
+static int records_read;
+static int records_bad;
+static int verify = 0;
+static char **exclude;
+static int excludes;
+static int skipping;
+static struct tape_index *record_index;
 static struct timeval tv[2];
 static int file_argc;
 static char** file_argv;
@@ -163,14 +209,152 @@ tops20_timestamp (time_t t)
   return (days << 18) | ticks;
 }
 
+static void
+write_job (struct job *j)
+{
+  struct word_stream s;
+  FILE *f;
+
+  mkdirs (j->path);
+  f = fopen (j->path, "wb");
+  if (f == NULL)
+    {
+      fprintf (stderr, "\nError opening output file %s: %s",
+	       j->path, strerror (errno));
+      return;
+    }
+
+  init_word_stream (&s, f, output_word_format);
+  stream_write_words (&s, j->words, j->used);
+  stream_flush_word (&s);
+  free_word_stream (&s);
+  fclose (f);
+  utimes (j->path, j->tv);
+}
+
+/* Is an earlier job for the same path still being written? */
+static int
+path_busy (const struct job *j)
+{
+  int i;
+
+  for (i = 0; i < writers; i++)
+    if (writing[i] != NULL && writing[i]->number < j->number
+	&& strcmp (writing[i]->path, j->path) == 0)
+      return 1;
+  return 0;
+}
+
+static void *
+worker (void *arg)
+{
+  int id = (int)(long)arg;
+  struct job *j;
+
+  for (;;)
+    {
+      pthread_mutex_lock (&queue_lock);
+      while (queue_count == 0 && !queue_done)
+	pthread_cond_wait (&queue_cond, &queue_lock);
+      if (queue_count == 0)
+	{
+	  pthread_mutex_unlock (&queue_lock);
+	  return NULL;
+	}
+      j = queue[queue_head];
+      queue_head = (queue_head + 1) % QUEUE;
+      queue_count--;
+      writing[id] = j;
+      pthread_cond_broadcast (&queue_cond);
+      while (path_busy (j))
+	pthread_cond_wait (&queue_cond, &queue_lock);
+      pthread_mutex_unlock (&queue_lock);
+
+      write_job (j);
+
+      pthread_mutex_lock (&queue_lock);
+      writing[id] = NULL;
+      queue_words -= j->used;
+      pthread_cond_broadcast (&queue_cond);
+      pthread_mutex_unlock (&queue_lock);
+      free (j->words);
+      free (j);
+    }
+}
+
+static void
+start_workers (void)
+{
+  int i;
+
+  if (threads <= 0)
+    threads = sysconf (_SC_NPROCESSORS_ONLN);
+  if (threads <= 0)
+    threads = 1;
+
+  workers = malloc (threads * sizeof *workers);
+  writing = calloc (threads, sizeof *writing);
+  if (workers == NULL || writing == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  writers = threads;
+  for (i = 0; i < threads; i++)
+    if (pthread_create (&workers[i], NULL, worker, (void *)(long)i) != 0)
+      break;
+  threads = i;
+}
+
+/* Hand a job to the workers, waiting if the queue is full.  The
+   words in a job count against the queue until it's written.  Without
+   workers, do it here. */
+static void
+queue_job (struct job *j)
+{
+  if (threads == 0)
+    {
+      write_job (j);
+      free (j->words);
+      free (j);
+      return;
+    }
+
+  pthread_mutex_lock (&queue_lock);
+  while (queue_count == QUEUE
+	 || (queue_words > 0 && queue_words + j->used > QUEUE_WORDS))
+    pthread_cond_wait (&queue_cond, &queue_lock);
+  j->number = jobs_queued++;
+  queue[(queue_head + queue_count) % QUEUE] = j;
+  queue_count++;
+  queue_words += j->used;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+}
+
+static void
+finish_workers (void)
+{
+  int i;
+
+  pthread_mutex_lock (&queue_lock);
+  queue_done = 1;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+  for (i = 0; i < threads; i++)
+    pthread_join (workers[i], NULL);
+  free (workers);
+  free (writing);
+}
+
 static void
 close_file (void)
 {
   fprintf (debug, "\nCLOSE %s", file_path);
-  flush_word (output);
-  fclose (output);
-  output = NULL;
-  utimes (file_path, tv);
+  job->tv[0] = tv[0];
+  job->tv[1] = tv[1];
+  queue_job (job);
+  job = NULL;
 }
 
 /* Convert TENEX file name to an acceptable Unix name. */
@@ -330,31 +514,41 @@ static void
 open_file (void)
 {
   mangle ();
-  mkdirs (file_path);
 
   fprintf (debug, "\nFILE: %s", file_path);
-  output = fopen (file_path, "wb");
-  if (output == NULL)
-    fprintf (stderr, "\nError opening output file %s: %s",
-	     file_path, strerror (errno));
+  job = calloc (1, sizeof *job);
+  if (job == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  strcpy (job->path, file_path);
 }
 
+/* Find the number of words in a file to write, which goes in its
+   header before the data.  If the file size doesn't tell, the words
+   are read into a buffer, and taken from there. */
+static word_t *file_words;
+static size_t file_words_size;
+static const word_t *next_word;
+static size_t words_in_buffer;
+
 static word_t
-file_size (char *name)
+file_size (FILE *f, char *name)
 {
-  word_t size = 0;
-  FILE *f = fopen (name, "rb");
-  if (f == NULL)
+  long size;
+
+  size = words_left (f);
+  if (size != -1)
+    next_word = NULL;
+  else
     {
-      fprintf (stderr, "\nError opening input file %s: %s",
-	       name, strerror (errno));
-      exit (1);
+      size = get_all_words (f, &file_words, &file_words_size);
+      next_word = file_words;
+      words_in_buffer = size;
     }
 
-  while (get_word (f) != -1)
-    size++;
-  fclose (f);
-  fprintf (debug, "\nFile %s size: %lld", name, size);
+  fprintf (debug, "\nFile %s size: %ld", name, size);
   return size;
 }
 
@@ -398,27 +592,113 @@ sum (word_t checksum, word_t data)
   return checksum & 0777777777777LL;
 }
 
+/* Add up n words, each masked to 36 bits.  Fewer than 2^28 words
+   can't overflow. */
+static unsigned long long
+add_words_scalar (const word_t *words, int n)
+{
+  unsigned long long total = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    total += words[i] & 0777777777777LL;
+  return total;
+}
+
+#ifdef X86_SIMD
+__attribute__ ((target ("avx2")))
+static unsigned long long
+add_words_avx2 (const word_t *words, int n)
+{
+  __m256i mask = _mm256_set1_epi64x (0777777777777LL);
+  __m256i total = _mm256_setzero_si256 ();
+  __m256i x;
+  unsigned long long lane[4];
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      x = _mm256_loadu_si256 ((const __m256i *)(words + i));
+      total = _mm256_add_epi64 (total, _mm256_and_si256 (x, mask));
+    }
+
+  _mm256_storeu_si256 ((__m256i *)lane, total);
+  return lane[0] + lane[1] + lane[2] + lane[3]
+    + add_words_scalar (words + i, n - i);
+}
+#endif
+
+static unsigned long long (*add_words) (const word_t *, int)
+  = add_words_scalar;
+
+/* Checksum of a block, taking the checksum word as zero like
+   write_record does. */
 static word_t
-read_record (FILE *f, word_t word)
+block_checksum (void)
 {
+  unsigned long long total;
   word_t checksum = 0;
   int i;
 
+  if (format <= 4)
+    {
+      /* Adding with end around carry can be done in any order, so add
+	 plainly, four words at a time with AVX2, and fold the carries
+	 back in at the end. */
+      total = add_words (block + 1, MAX - 1);
+      while (total >> 36)
+	total = (total & 0777777777777LL) + (total >> 36);
+      return total;
+    }
+
+  /* The rotating checksum of the newer formats depends on every
+     previous step, so it stays a scalar loop. */
+  for (i = 1; i < MAX; i++)
+    checksum = sum (checksum, block[i]);
+  return checksum;
+}
+
+/* Check the block just read, and report it if it's bad.  Return
+   nonzero if it's good. */
+static int
+check_record (int complete)
+{
+  records_read++;
+  if (complete && block_checksum () == (block[0] ^ 0777777777777LL))
+    return 1;
+
+  records_bad++;
+  fprintf (stderr, "%s in saveset %d, file %s, page %d, record %lld.\n",
+	   complete ? "Bad checksum" : "Short record",
+	   left (block[2]), *record_file ? record_file : "-",
+	   right (block[3]), block[5]);
+  return 0;
+}
+
+/* Read a block into block[], starting with word.  Set *complete to
+   whether all of it was there.  Return the word after a short block,
+   or 0 if the next one hasn't been started. */
+static word_t
+read_record (FILE *f, word_t word, int *complete)
+{
+  int i;
+
+  *complete = 0;
   block[0] = word & 0777777777777LL;
-  checksum = sum (checksum, block[0]);
   for (i = 1; i < MAX; i++)
     {
       word = get_word (f);
-      if (word == -1)
-	return word;
-      if (word & (START_RECORD | START_FILE | START_TAPE))
-	return word;
+      if (word == -1 || (word & (START_RECORD | START_FILE | START_TAPE)))
+	{
+	  memset (block + i, 0, (MAX - i) * sizeof (word_t));
+	  return word;
+	}
       block[i] = word;
-      checksum = sum (checksum, word);
     }
+  *complete = 1;
 
 #if 0
-  fprintf (stderr, "Checksum: %012llo\n", checksum);
+  fprintf (stderr, "Checksum: %012llo\n", block_checksum ());
   fprintf (stderr, "000: %012llo\n", block[0]);
   fprintf (stderr, "001: %012llo\n", block[1]);
   fprintf (stderr, "002: %012llo saveset,,tape\n", block[2]);
@@ -427,24 +707,34 @@ read_record (FILE *f, word_t word)
   fprintf (stderr, "005: %012llo record\n", block[5]);
 #endif
 
-  return get_word (f);
+  return 0;
 }
 
 static word_t
 read_tape_header (FILE *f, word_t word)
 {
   char name[100];
+  int complete;
 
-  word = read_record (f, word);
+  word = read_record (f, word, &complete);
+  if (word == 0)
+    word = get_word (f);
 
   // Check tape format! Otherwise breaks e.g. on Install tapes (which aren't in dumper format).
   if ((data[0] < 4) || (data[0] > 6)) {
     // Formats older than 4 not supported, and 6 was the highest (TOPS-20 v6-7).
     // If you want to support older fmts, write the code. :-)
     fprintf (stderr, "Bad dumper tape format %012llo\n", data[0]);
+    /* Verifying, the tape must not look clean. */
+    records_read++;
+    records_bad++;
     return -1;
   }
 
+  /* The format decides how the checksum is computed. */
+  format = data[0];
+  check_record (complete);
+
   // Get the saveset name from the right place.
   // In TOPS-20 v4-5, see DUMPER.MAC, label SETHDR.
   // In TOPS-20 v6-7, see DUMPER.MAC, label NOSPCL.
@@ -460,6 +750,40 @@ read_tape_header (FILE *f, word_t word)
   return word;
 }
 
+/* Is the file to be listed or extracted?  With no patterns on the
+   command line, every file is, except the ones excluded. */
+static int
+selected (const char *name)
+{
+  int i;
+
+  for (i = 0; i < excludes; i++)
+    if (fnmatch (exclude[i], name, 0) == 0)
+      return 0;
+  if (file_argc == 0)
+    return 1;
+  for (i = 0; i < file_argc; i++)
+    if (fnmatch (file_argv[i], name, 0) == 0)
+      return 1;
+  return 0;
+}
+
+/* Go past the data records of a file that isn't selected, without
+   reading them.  That takes a tape index, or else the records are
+   read and ignored. */
+static void
+skip_data (FILE *f)
+{
+  word_t header[5];
+
+  if (record_index == NULL)
+    return;
+  while (peek_tape_record (f, record_index, header, 5) == 5
+	 && ((01000000000000LL - header[4]) & 0777777777777LL) == DATA
+	 && skip_tape_record (f, record_index) == 0)
+    ;
+}
+
 static void
 read_file (int offset)
 {
@@ -468,11 +792,17 @@ read_file (int offset)
 
   if (offset != 0206)
     {
-      if (output != NULL)
+      if (job != NULL)
 	close_file ();
+      *record_file = 0;
+      skipping = 0;
       return;
     }
 
+  /* A file without a trailer. */
+  if (job != NULL)
+    close_file ();
+
   read_asciz (file_path, &data[0]);
 
   p = strchr (file_path, ';');
@@ -480,6 +810,11 @@ read_file (int offset)
     p = strchr (p + 1, ';');
   if (p)
     *p = 0;
+  strcpy (record_file, file_path);
+
+  skipping = !selected (file_path);
+  if (verify || skipping)
+    return;
 
   fprintf (stderr, " %-40s", file_path);
   print_timestamp (stderr, block[offset + 5]);
@@ -516,28 +851,56 @@ read_file (int offset)
 static void
 read_data (void)
 {
+  word_t *words;
   int i;
-  if (output == NULL)
+  if (job == NULL)
     return;
-  for (i = 0; i < 512 && file_bytes >= 0; i++, file_bytes -= word_bytes)
-    write_word (output, data[i]);
+  for (i = 0; i < 512 && file_bytes >= 0; i++)
+    file_bytes -= word_bytes;
+
+  if (job->used + i > job->size)
+    {
+      job->size = job->size == 0 ? 4096 : 2 * job->size;
+      words = realloc (job->words, job->size * sizeof *words);
+      if (words == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      job->words = words;
+    }
+  memcpy (job->words + job->used, data, i * sizeof *data);
+  job->used += i;
 }
 
 static void
 read_tape (FILE *f)
 {
   word_t word;
+  int complete, good;
+
+  if (extract)
+    start_workers ();
 
   word = get_word (f);
 
   word = read_tape_header (f, word);
   while (word != -1)
     {
-      word = read_record (f, word);
+      if (word == 0)
+	{
+	  if (skipping)
+	    skip_data (f);
+	  if ((word = get_word (f)) == -1)
+	    break;
+	}
+      word = read_record (f, word, &complete);
+      good = check_record (complete);
       switch ((01000000000000LL - block[4]) & 0777777777777LL)
 	{
 	case DATA:
-	  read_data ();
+	  if (!verify && !skipping)
+	    read_data ();
 	  break;
 	case TPHD:
 	  break;
@@ -556,11 +919,27 @@ read_tape (FILE *f)
 	case FILL:
 	  break;
 	default:
+	  /* Already reported. */
+	  if (!good)
+	    break;
 	  fprintf (stderr, "Unknown record type %#llo.\n", word);
 	  exit (1);
 	  break;
 	}
     }
+
+  if (extract)
+    {
+      if (job != NULL)
+	close_file ();
+      finish_workers ();
+    }
+
+  if (verify)
+    {
+      fprintf (list, "%d records, %d bad.", records_read, records_bad);
+      exit (records_bad != 0 || records_read == 0);
+    }
 }
 
 static void
@@ -631,24 +1010,29 @@ write_record (FILE *f, int type)
 static int
 get_page (FILE *f)
 {
-  word_t word;
-  int ok = 0;
-  int i;
+  size_t i, n;
 
   memset (data, 0, 512 * sizeof (word_t));
 
   /* If the first word indicates EOF, return "no page".
      In other cases, return a partial or full page. */
-  for (i = 0; i < 512; i++)
+  if (next_word != NULL)
     {
-      word = get_word (f);
-      if (word == -1)
-	return ok;
-      data[i] = word;
-      ok = 1;
+      n = words_in_buffer < 512 ? words_in_buffer : 512;
+      memcpy (data, next_word, n * sizeof (word_t));
+      next_word += n;
+      words_in_buffer -= n;
+      return n > 0;
     }
 
-  return 1;
+  for (i = 0; i < 512; i += n)
+    {
+      n = get_words (f, data + i, 512 - i);
+      if (n == 0)
+	break;
+    }
+
+  return i > 0;
 }
 
 static void
@@ -673,7 +1057,7 @@ write_file (FILE *f, char *name)
     fprintf (stderr, "\nError calling stat on file %s: %s",
 	     name, strerror (errno));
 
-  size = file_size (name);
+  size = file_size (input, name);
   if (0)
     strcpy (device, "PS");
   byte_size = 36;
@@ -779,7 +1163,8 @@ static void
 usage (const char *x)
 {
   fprintf (stderr,
-	   "Usage: %s -c|-t|-x [-v0123456] [-Wformat] [-Cdir] [-f file]\n", x);
+	   "Usage: %s -c|-t|-x|-V [-v0123456] [-Wformat] [-Cdir] [-f file] [-s saveset]\n"
+	   "       [-I] [-n threads] [-X exclude] [file...]\n", x);
   usage_word_format ();
   exit (1);
 }
@@ -798,12 +1183,19 @@ main (int argc, char **argv)
   char *tape_name = NULL, *mode;
   char *directory = NULL;
   int verbose = 0;
+  int saveset = 0;
   FILE *f = NULL;
   int opt;
 
   input_word_format = &tape_word_format;
   output_word_format = &aa_word_format;
 
+#ifdef X86_SIMD
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2"))
+    add_words = add_words_avx2;
+#endif
+
   /* If you ask for a file listing with -t or -xv, it's considered the
      output data and written to stdout.  Overriden by -c, see below. */
   list = stdout;
@@ -817,7 +1209,7 @@ main (int argc, char **argv)
   else
     format = 0;
 
-  while ((opt = getopt (argc, argv, "ctvx0123456f:W:C:")) != -1)
+  while ((opt = getopt (argc, argv, "ctvxV0123456f:In:s:W:C:X:")) != -1)
     {
       switch (opt)
 	{
@@ -829,6 +1221,28 @@ main (int argc, char **argv)
 	    }
 	  tape_name = optarg;
 	  break;
+	case 'n':
+	  /* Threads writing extracted files. */
+	  threads = atoi (optarg);
+	  break;
+	case 'X':
+	  /* Don't list or extract files matching this. */
+	  exclude = realloc (exclude, (excludes + 1) * sizeof *exclude);
+	  if (exclude == NULL)
+	    {
+	      fprintf (stderr, "Out of memory.\n");
+	      exit (1);
+	    }
+	  exclude[excludes++] = upcase (optarg);
+	  break;
+	case 's':
+	  /* Start reading at this tape file, counting from 0. */
+	  saveset = atoi (optarg);
+	  break;
+	case 'I':
+	  /* Keep the tape index in a sidecar next to the image. */
+	  write_tape_index = 1;
+	  break;
 	case 't':
 	  if (process_tape != NULL)
 	    {
@@ -852,6 +1266,18 @@ main (int argc, char **argv)
 	  mode = "rb";
 	  extract = 1;
 	  break;
+	case 'V':
+	  /* Just check the records. */
+	  if (process_tape != NULL)
+	    {
+	      fprintf (stderr, "Just one of -c, -t, -x, or -V allowed.\n");
+	      exit (1);
+	    }
+	  process_tape = read_tape;
+	  mode = "rb";
+	  verify = 1;
+	  verbose++;
+	  break;
 	case 'c':
 	  if (process_tape != NULL)
 	    {
@@ -914,6 +1340,39 @@ main (int argc, char **argv)
       exit (1);
     }
 
+  file_argc = argc - optind;
+  file_argv = argv + optind;
+
+  /* Go straight to the saveset using the tape index. */
+  if (saveset > 0)
+    {
+      if (f == NULL || process_tape != read_tape)
+	usage (argv[0]);
+      record_index = load_tape_index (tape_name, f);
+      if (record_index == NULL)
+	{
+	  fprintf (stderr, "Can't seek in unseekable tape image.\n");
+	  exit (1);
+	}
+      if (seek_tape_file (f, record_index, saveset) == -1)
+	{
+	  fprintf (stderr, "No saveset %d on tape.\n", saveset);
+	  exit (1);
+	}
+    }
+
+  /* When reading, the file arguments are patterns for the files to
+     list or extract.  The index is used to go past the others. */
+  if (process_tape == read_tape)
+    {
+      int i;
+      for (i = 0; i < file_argc; i++)
+	upcase (file_argv[i]);
+      if (record_index == NULL && (file_argc > 0 || excludes > 0)
+	  && f != NULL && ftell (f) != -1)
+	record_index = load_tape_index (tape_name, f);
+    }
+
   if (directory && chdir (directory) == -1)
     {
       fprintf (stderr, "\nError entering directory %s: %s",
@@ -921,8 +1380,6 @@ main (int argc, char **argv)
       exit (1);
     }
 
-  file_argc = argc - optind;
-  file_argv = argv + optind;
   atexit (newline);
   process_tape (f);
 
@@ -118,10 +118,10 @@ read_exe (FILE *f, struct pdp10_memory *memory, int cpu_model)
  enddir:
 
   /* Skip to the end of the first page */
-  while (position < DEC_PAGESIZE)
+  if (position < DEC_PAGESIZE)
     {
-      get_word (f);
-      position++;
+      seek_word (f, DEC_PAGESIZE);
+      position = DEC_PAGESIZE;
     }
 
   /* Map the remaining pages into memory */
@@ -90,8 +90,7 @@ parse_output_file_format (const char *string)
 void
 guess_input_file_format (FILE *file)
 {
-  word_t word = get_word (file);
-  rewind_word (file);
+  word_t word = peek_word (file);
 
   if ((word >> 18) == 01776)
     input_file_format = &exe_file_format;
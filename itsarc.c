@@ -15,6 +15,11 @@
 
 #include <time.h>
 #include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/time.h>
 
 #include "dis.h"
@@ -26,14 +31,33 @@
 #define LEFT 0777777000000LL
 #define RIGHT 0777777LL
 
+/* A file in the archive.  Its words are in the archive buffer, except
+   for an old archive where they are gathered from its blocks. */
+struct entry {
+  char filename[14];
+  word_t *words;
+  word_t length;
+  word_t modified, referenced;
+  int gathered;
+  int superseded;
+};
+
 static int old = 0;
 
-/* Just allocate a full moby to hold the file. */
-static word_t buffer[256 * 1024];
+/* The archive, with room for at least a full moby. */
+#define MOBY (256 * 1024)
+static word_t *buffer;
+static size_t buffer_size;
+
+static struct entry table[02000 / 5 + 1];
+static int entries;
+static int next_entry;
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static int threads;
 
 static void usage (const char *x)
 {
-  fprintf (stderr, "Usage: %s -x|-t <file>\n", x);
+  fprintf (stderr, "Usage: %s -x|-t|-l [-n threads] <file>...\n", x);
   exit (1);
 }
 
@@ -66,19 +90,84 @@ timestamps (char *filename, word_t modified, word_t referenced)
 }
 
 static void
-extract_file (char *filename, word_t *data, word_t length)
+extract_file (struct entry *e)
 {
+  struct word_stream s;
   FILE *f;
-  int i;
 
-  f = fopen(filename, "wb");
-  for (i = 0; i < length; i++)
+  f = fopen (e->filename, "wb");
+  if (f == NULL)
     {
-      write_word (f, *data++);
+      fprintf (stderr, "Error opening output file %s: %s\n",
+	       e->filename, strerror (errno));
+      return;
     }
 
-  flush_word (f);
+  init_word_stream (&s, f, output_word_format);
+  stream_write_words (&s, e->words, e->length);
+  stream_flush_word (&s);
+  free_word_stream (&s);
   fclose (f);
+  timestamps (e->filename, e->modified, e->referenced);
+}
+
+static void *
+worker (void *arg)
+{
+  int i;
+
+  (void)arg;
+  for (;;)
+    {
+      pthread_mutex_lock (&table_lock);
+      i = next_entry++;
+      pthread_mutex_unlock (&table_lock);
+      if (i >= entries)
+	return NULL;
+      if (!table[i].superseded)
+	extract_file (&table[i]);
+    }
+}
+
+/* Write the files in the table, on a pool of threads. */
+static void
+extract_files (void)
+{
+  pthread_t *workers;
+  int i, j, n;
+
+  /* Of two files with the same name, the last one is kept. */
+  for (i = 0; i < entries; i++)
+    for (j = i + 1; j < entries; j++)
+      if (strcmp (table[i].filename, table[j].filename) == 0)
+	table[i].superseded = 1;
+
+  n = threads;
+  if (n <= 0)
+    n = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n <= 0)
+    n = 1;
+  workers = malloc (n * sizeof *workers);
+  if (workers == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+
+  next_entry = 0;
+  for (i = 0; i < n; i++)
+    if (pthread_create (&workers[i], NULL, worker, NULL) != 0)
+      break;
+  if (i == 0)
+    worker (NULL);
+  n = i;
+  for (i = 0; i < n; i++)
+    pthread_join (workers[i], NULL);
+  free (workers);
+
+  for (i = 0; i < entries; i++)
+    if (table[i].gathered)
+      free (table[i].words);
 }
 
 static int
@@ -99,27 +188,33 @@ ildb (word_t **w, int *p)
 }
 
 static int
-extract_block (FILE *f, word_t *block, int *b, int *count)
+extract_block (struct entry *e, word_t *block, int *b, int *count)
 {
   word_t header = *block;
-  int i, n;
+  word_t *words;
+  int n;
 
   *b = header & 017777777;
   n = ((header >> 23) & 01777) + 1;
-  *count += n;
 
-  if (f)
+  if (e)
     {
-      block++;
-      for (i = 0; i < n; i++)
-	write_word (f, block[i]);
+      words = realloc (e->words, (*count + n) * sizeof *words);
+      if (words == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      memcpy (words + *count, block + 1, n * sizeof *words);
+      e->words = words;
     }
+  *count += n;
 
   return (header & 0200000000000LL) == 0;
 }
 
 static int
-extract_blocks (FILE *f, word_t *ufd, int undscp)
+extract_blocks (struct entry *e, word_t *ufd, int undscp)
 {
   word_t *d;
   int o, b, n, n2, n3;
@@ -140,76 +235,95 @@ extract_blocks (FILE *f, word_t *ufd, int undscp)
   b = ((n & 037) << 12) + (n2 << 6) + n3;
 
   b = buffer[02005+b];
-  while (extract_block (f, &buffer[b], &b, &count))
+  while (extract_block (e, &buffer[b], &b, &count))
     ;
 
   return count;
 }
 
+/* Gather the blocks of a file in an old archive, if it's to be
+   extracted, and return its length. */
 static int
-extract_old_file (char *filename, int i, int extract)
+extract_old_file (struct entry *e, int i, int extract)
 {
   word_t *ufd = buffer;
   int undscp = ufd[i+2] & 017777;
-  FILE *f = NULL;
-  int n;
-
-  if (extract)
-    f = fopen(filename, "wb");
-
-  n = extract_blocks (f, ufd, undscp);
 
-  if (extract)
-    {
-      flush_word (f);
-      fclose (f);
-    }
-
-  return n;
+  if (!extract)
+    return extract_blocks (NULL, ufd, undscp);
+  e->gathered = 1;
+  return extract_blocks (e, ufd, undscp);
 }
 
-int
-main (int argc, char **argv)
+/* Read the archive into the buffer.  A listing only needs the
+   directory, which comes first. */
+static void
+read_archive (const char *name, int directory_only)
 {
-  int extract;
-  char string[7];
-  word_t word;
+  struct word_stream s;
+  size_t words, size;
   word_t *p;
   FILE *f;
 
-  input_word_format = &its_word_format;
-  output_word_format = &its_word_format;
-  output_file = stdout;
-
-  if (argc != 3)
-    usage (argv[0]);
-
-  if (argv[1][0] != '-')
-    usage (argv[0]);
-
-  switch (argv[1][1])
+  f = fopen (name, "rb");
+  if (f == NULL)
     {
-    case 't':
-      extract = 0;
-      break;
-    case 'x':
-      extract = 1;
-      break;
-    default:
-      usage (argv[0]);
-      break;
+      fprintf (stderr, "Error opening %s: %s\n", name, strerror (errno));
+      exit (1);
     }
 
-  f = fopen (argv[2], "rb");
-
-  p = buffer;
-  while ((word = get_word (f)) != -1)
+  init_word_stream (&s, f, input_word_format);
+  map_word_stream (&s);
+  if (directory_only)
     {
-      *p++ = word;
+      if (buffer_size < 02000)
+	{
+	  buffer = realloc (buffer, 02000 * sizeof *buffer);
+	  buffer_size = 02000;
+	}
+      if (buffer == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      words = stream_get_words (&s, buffer, 02000);
     }
+  else
+    words = stream_get_all_words (&s, &buffer, &buffer_size);
+  free_word_stream (&s);
   fclose (f);
 
-  /* word_t arc_size = p - buffer; */
+  /* Pointers in a damaged archive may go past the end. */
+  size = directory_only ? 02000 : MOBY;
+  if (size < words)
+    size = words;
+  if (buffer_size < size)
+    {
+      p = realloc (buffer, size * sizeof *buffer);
+      if (p == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      buffer = p;
+      buffer_size = size;
+    }
+  memset (buffer + words, 0, (size - words) * sizeof *buffer);
+}
+
+/* List, and maybe extract, one archive.  With directory_only, just
+   the directory is read, and the file lengths are left out. */
+static void
+arc (const char *name, int extract, int directory_only)
+{
+  char string[7];
+  struct entry *e;
+  word_t name_beg;
+  int i;
+
+  read_archive (name, directory_only);
+  old = 0;
+  entries = 0;
 
   if (buffer[0] == NEW_ARC)
     {
@@ -233,7 +347,6 @@ main (int argc, char **argv)
       exit (1);
     }
 
-  word_t name_beg;
   if (old)
      name_beg = buffer[2];
   else
@@ -254,39 +367,45 @@ main (int argc, char **argv)
       fprintf (stderr, "Dumped: %llo\n", dumped);
     }
 
-  fprintf (stderr, "\nFile name       Words  Modified             Referenced  Byte\n");
+  if (directory_only)
+    fprintf (stderr, "\nFile name      Modified             Referenced  Byte\n");
+  else
+    fprintf (stderr, "\nFile name       Words  Modified             Referenced  Byte\n");
 
-  int i;
   for (i = name_beg; i < 02000; i += 5)
     {
-      char filename[14];
-      word_t modified, referenced;
+      e = &table[entries++];
+      memset (e, 0, sizeof *e);
 
-      sixbit_to_ascii(buffer[i], filename);
-      fprintf (stderr, "%s ", filename);
-      sixbit_to_ascii(buffer[i+1], filename + 7);
-      fprintf (stderr, "%s  ", filename + 7);
+      sixbit_to_ascii(buffer[i], e->filename);
+      fprintf (stderr, "%s ", e->filename);
+      sixbit_to_ascii(buffer[i+1], e->filename + 7);
+      fprintf (stderr, "%s  ", e->filename + 7);
 
       /* File name for extraction. */
-      weenixpath (filename, -1LL, buffer[i], buffer[i+1]);
+      weenixpath (e->filename, -1LL, buffer[i], buffer[i+1]);
 
       /* word_t flags = buffer[i+2] >> 18; */
       word_t data = buffer[i+2] & RIGHT;
 
-      modified = buffer[i+3];
-      referenced = (buffer[i+4] & LEFT);
+      e->modified = buffer[i+3];
+      e->referenced = (buffer[i+4] & LEFT);
 
-      word_t length;
-      if (old) {
-	length = extract_old_file (filename, i, extract);
-	timestamps (filename, modified, referenced);
-      } else
-	length = buffer[data] - 3;
-      fprintf (stderr, "%6lld  ", length);
+      if (directory_only)
+	;
+      else if (old)
+	e->length = extract_old_file (e, i, extract);
+      else
+	{
+	  e->length = buffer[data] - 3;
+	  e->words = &buffer[data+3];
+	}
+      if (!directory_only)
+	fprintf (stderr, "%6lld  ", e->length);
 
-      print_datime (stderr, modified);
+      print_datime (stderr, e->modified);
       fputs ("  ", stderr);
-      print_date (stderr, referenced);
+      print_date (stderr, e->referenced);
 
       if (!old)
 	{
@@ -298,13 +417,58 @@ main (int argc, char **argv)
       int leftovers;
       fprintf (stderr, "  %d\n",
 	       byte_size (buffer[i+4] & 0777, &leftovers));
+    }
+
+  if (extract)
+    extract_files ();
+}
+
+int
+main (int argc, char **argv)
+{
+  int extract = -1, directory_only = 0;
+  int opt, i;
+
+  input_word_format = &its_word_format;
+  output_word_format = &its_word_format;
+  output_file = stdout;
 
-      if (!old && extract)
+  while ((opt = getopt (argc, argv, "ltxn:")) != -1)
+    {
+      switch (opt)
 	{
-	  extract_file (filename, &buffer[data+3], length);
-	  timestamps (filename, modified, referenced);
+	case 'l':
+	  directory_only = 1;
+	  /* Fall through. */
+	case 't':
+	  if (extract != -1)
+	    usage (argv[0]);
+	  extract = 0;
+	  break;
+	case 'x':
+	  if (extract != -1)
+	    usage (argv[0]);
+	  extract = 1;
+	  break;
+	case 'n':
+	  /* Threads writing extracted files. */
+	  threads = atoi (optarg);
+	  break;
+	default:
+	  usage (argv[0]);
+	  break;
 	}
     }
 
+  if (extract == -1 || optind == argc)
+    usage (argv[0]);
+
+  for (i = optind; i < argc; i++)
+    {
+      if (argc - optind > 1)
+	fprintf (stderr, "%s%s:\n", i == optind ? "" : "\n", argv[i]);
+      arc (argv[i], extract, directory_only);
+    }
+
   return 0;
 }
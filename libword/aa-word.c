@@ -28,55 +28,72 @@
 
 #include "libword.h"
 
-static word_t output = -1;
+struct aa_state {
+  word_t output;
+};
 
 static inline int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c = stream_getc (s);
   return c == EOF ? 0 : c;
 }
 
+static void *
+new_aa_state (void)
+{
+  struct aa_state *state = new_word_state (sizeof *state);
+  state->output = -1;
+  return state;
+}
+
 static word_t
-get_aa_word (FILE *f)
+get_aa_word (struct word_stream *s)
 {
   word_t word = 0;
   word_t x;
 
-  if (feof (f))
+  if (stream_eof (s))
     return -1;
 
-  x = get_byte (f); word += (x & 0177) << 29;
-  if (feof (f))
+  x = get_byte (s); word += (x & 0177) << 29;
+  if (stream_eof (s))
     return -1;
-  x = get_byte (f); word += (x & 0177) << 22;
-  x = get_byte (f); word += (x & 0177) << 15;
-  x = get_byte (f); word += (x & 0177) <<  8;
-  x = get_byte (f); word += (x & 0177) <<  1;
+  x = get_byte (s); word += (x & 0177) << 22;
+  x = get_byte (s); word += (x & 0177) << 15;
+  x = get_byte (s); word += (x & 0177) <<  8;
+  x = get_byte (s); word += (x & 0177) <<  1;
                     word += (x & 0200) >>  7;
 
   return word;
 }
 
 static void
-write_aa_word (FILE *f, word_t word)
+write_aa_word (struct word_stream *s, word_t word)
 {
+  struct aa_state *state = s->state;
+  word_t output = state->output;
+  unsigned char octets[5];
+
   if (output != -1)
     {
-      fputc ((output >> 29) & 0177, f);
-      fputc ((output >> 22) & 0177, f);
-      fputc ((output >> 15) & 0177, f);
-      fputc ((output >>  8) & 0177, f);
-      fputc (((output >> 1) & 0177) +
-	     ((output << 7) & 0200), f);
+      octets[0] = (output >> 29) & 0177;
+      octets[1] = (output >> 22) & 0177;
+      octets[2] = (output >> 15) & 0177;
+      octets[3] = (output >>  8) & 0177;
+      octets[4] = ((output >> 1) & 0177) + ((output << 7) & 0200);
+      fwrite (octets, 1, 5, s->file);
     }
 
-  output = word;
+  state->output = word;
 }
 
 static void
-flush_aa_word (FILE *f)
+flush_aa_word (struct word_stream *s)
 {
+  struct aa_state *state = s->state;
+  word_t output = state->output;
+  FILE *f = s->file;
   int i, c;
   if (output == -1)
     return;
@@ -92,7 +109,20 @@ flush_aa_word (FILE *f)
       fputc (c, f);
       output <<= 7;
     }
-  output = -1;
+  state->output = -1;
+}
+
+/* The eighth bit is only used in the last octet of a word. */
+static int
+score_aa (const unsigned char *octets, size_t n, int whole)
+{
+  size_t i, good = 0;
+
+  (void)whole;
+  for (i = 0; i + 5 <= n; i += 5)
+    if (((octets[i] | octets[i + 1] | octets[i + 2] | octets[i + 3]) & 0200) == 0)
+      good++;
+  return word_score (good, n / 5, 1.0 / 16);
 }
 
 struct word_format aa_word_format = {
@@ -101,5 +131,12 @@ struct word_format aa_word_format = {
   NULL,
   by_five_octets,
   write_aa_word,
-  flush_aa_word
+  flush_aa_word,
+  NULL,
+  NULL,
+  new_aa_state,
+  NULL,
+  NULL,
+  NULL,
+  score_aa
 };
@@ -18,42 +18,58 @@
 #include "libword.h"
 
 static int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c = stream_getc (s);
   return c == EOF ? 0 : c;
 }
 
-word_t
-get_alto_word (FILE *f)
+static word_t
+get_alto_word (struct word_stream *s)
 {
   word_t x1, x2, x3, x4, x5;
   word_t word;
 
-  if (feof (f))
+  if (stream_eof (s))
     return -1;
 
-  x1 = get_byte (f);
-  if (feof (f))
+  x1 = get_byte (s);
+  if (stream_eof (s))
     return -1;
-  x2 = get_byte (f);
-  x3 = get_byte (f);
-  x4 = get_byte (f);
-  x5 = get_byte (f);
+  x2 = get_byte (s);
+  x3 = get_byte (s);
+  x4 = get_byte (s);
+  x5 = get_byte (s);
   word = (x1 << 32) | (x2 << 24) | (x3 << 16) | (x4 << 8) | x5;
   word &= 0777777777777LL;
 
   return word;
 }
 
-void
-write_alto_word (FILE *f, word_t word)
+static void
+write_alto_word (struct word_stream *s, word_t word)
 {
-  fputc ((word >> 32) & 0x0F, f);
-  fputc ((word >> 24) & 0xFF, f);
-  fputc ((word >> 16) & 0xFF, f);
-  fputc ((word >>  8) & 0xFF, f);
-  fputc ( word        & 0xFF, f);
+  unsigned char octets[5];
+
+  octets[0] = (word >> 32) & 0x0F;
+  octets[1] = (word >> 24) & 0xFF;
+  octets[2] = (word >> 16) & 0xFF;
+  octets[3] = (word >>  8) & 0xFF;
+  octets[4] =  word        & 0xFF;
+  fwrite (octets, 1, 5, s->file);
+}
+
+/* The first octet of a word only has four bits. */
+static int
+score_alto (const unsigned char *octets, size_t n, int whole)
+{
+  size_t i, good = 0;
+
+  (void)whole;
+  for (i = 0; i + 5 <= n; i += 5)
+    if ((octets[i] & 0xF0) == 0)
+      good++;
+  return word_score (good, n / 5, 1.0 / 16);
 }
 
 struct word_format alto_word_format = {
@@ -62,5 +78,12 @@ struct word_format alto_word_format = {
   NULL,
   by_five_octets,
   write_alto_word,
-  NULL
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  score_alto
 };
@@ -15,51 +15,69 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "libword.h"
 
+/* Number of word pairs decoded from each read. */
+#define CHUNK 512
+
 #define WORDMASK	(0777777777777LL)
 #define SIGNBIT		(0400000000000LL)
 
-static int leftover_input, have_leftover_input = 0;
-static int leftover_output, have_leftover_output = 0;
+struct bin_state {
+  int leftover_input, have_leftover_input;
+  int leftover_output, have_leftover_output;
+};
 
 static inline int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c = stream_getc (s);
   return c == EOF ? 0 : c;
 }
 
+static void *
+new_bin_state (void)
+{
+  return new_word_state (sizeof (struct bin_state));
+}
+
 static word_t
-get_bin_word (FILE *f)
+get_bin_word (struct word_stream *s)
 {
+  struct bin_state *state = s->state;
   unsigned char byte;
   word_t word;
 
-  if (feof (f))
-    return -1;
+  /* Half an octet left at the end belongs to no word, and mustn't be
+     taken for the start of the next file read with the same state. */
+  if (stream_eof (s))
+    {
+      state->have_leftover_input = 0;
+      return -1;
+    }
 
-  if (have_leftover_input)
+  if (state->have_leftover_input)
     {
-      word = (word_t)leftover_input << 32 |
-	     (word_t)get_byte (f) << 24 |
-	     (word_t)get_byte (f) << 16 |
-             (word_t)get_byte (f) <<  8 |
-             (word_t)get_byte (f) <<  0;
-      have_leftover_input = 0;
+      word = (word_t)state->leftover_input << 32 |
+	     (word_t)get_byte (s) << 24 |
+	     (word_t)get_byte (s) << 16 |
+             (word_t)get_byte (s) <<  8 |
+             (word_t)get_byte (s) <<  0;
+      state->have_leftover_input = 0;
     }
   else
     {
-      word =  ((word_t)get_byte (f) << 28);
-      if (feof (f))
+      word =  ((word_t)get_byte (s) << 28);
+      if (stream_eof (s))
 	return -1;
-      word |= ((word_t)get_byte (f) << 20) |
-	      ((word_t)get_byte (f) << 12) |
-              ((word_t)get_byte (f) <<  4);
-      byte = get_byte (f);
+      word |= ((word_t)get_byte (s) << 20) |
+	      ((word_t)get_byte (s) << 12) |
+              ((word_t)get_byte (s) <<  4);
+      byte = get_byte (s);
       word |=  (word_t)byte >> 4;
-      have_leftover_input = 1;
-      leftover_input = byte & 0x0f;
+      state->have_leftover_input = 1;
+      state->leftover_input = byte & 0x0f;
     }
 
   if (word > WORDMASK)
@@ -71,56 +89,157 @@ get_bin_word (FILE *f)
   return word;
 }
 
+static size_t
+get_bin_words (struct word_stream *s, word_t *buffer, size_t n)
+{
+  struct bin_state *state = s->state;
+  unsigned char octets[9 * CHUNK];
+  const unsigned char *p;
+  size_t m, got, count = 0;
+  word_t word;
+
+  /* Finish a word pair started by get_bin_word. */
+  if (state->have_leftover_input && n > 0)
+    {
+      if ((word = get_bin_word (s)) == -1)
+        return 0;
+      buffer[count++] = word;
+    }
+
+  while (n - count >= 2 && !stream_eof (s))
+    {
+      m = (n - count) / 2;
+      if (m > CHUNK)
+        m = CHUNK;
+      p = stream_octets (s, octets, 9 * m, &got);
+      if (got < 9 * m)
+        {
+          /* Same padding as get_bin_word: a word where the file ends
+             is filled with zeros, but a word starting at the end is
+             not returned. */
+          memmove (octets, p, got);
+          memset (octets + got, 0, 9 * m - got);
+          unpack_bin_words (octets, buffer + count, got / 9 + 1);
+          count += 2 * (got / 9);
+          switch (got % 9)
+            {
+            case 0:
+              break;
+            case 1: case 2: case 3: case 4:
+              state->have_leftover_input = 1;
+              state->leftover_input = octets[got - got % 9 + 4] & 0x0f;
+              count++;
+              break;
+            default:
+              count += 2;
+              break;
+            }
+          return count;
+        }
+      unpack_bin_words (p, buffer + count, m);
+      count += 2 * m;
+    }
+
+  /* An odd word leaves half an octet for the next call. */
+  if (count < n && (word = get_bin_word (s)) != -1)
+    buffer[count++] = word;
+
+  return count;
+}
+
 static void
-rewind_bin_word (FILE *f)
+rewind_bin_word (struct word_stream *s)
 {
-  have_leftover_input = 0;
-  rewind (f);
+  struct bin_state *state = s->state;
+  state->have_leftover_input = 0;
+  stream_rewind (s);
 }
 
 static void
-seek_bin_word (FILE *f, int position)
+seek_bin_word (struct word_stream *s, int position)
 {
-  rewind_bin_word (f);
-  fseek (f, 9 * position / 2, SEEK_SET);
+  struct bin_state *state = s->state;
+  rewind_bin_word (s);
+  stream_seek (s, 9 * position / 2);
   if (position & 1)
     {
-      leftover_input = get_byte (f) & 0x0f;
-      have_leftover_input = 1;
+      state->leftover_input = get_byte (s) & 0x0f;
+      state->have_leftover_input = 1;
     }
 }
 
 static void
-write_bin_word (FILE *f, word_t word)
+write_bin_word (struct word_stream *s, word_t word)
 {
-  if (have_leftover_output)
+  struct bin_state *state = s->state;
+  unsigned char octets[5];
+
+  if (state->have_leftover_output)
     {
-      fputc (leftover_output | ((word >> 32) & 0x0f), f);
-      fputc ((word >> 24) & 0xff, f);
-      fputc ((word >> 16) & 0xff, f);
-      fputc ((word >>  8) & 0xff, f);
-      fputc ((word >>  0) & 0xff, f);
-      have_leftover_output = 0;
+      octets[0] = state->leftover_output | ((word >> 32) & 0x0f);
+      octets[1] = (word >> 24) & 0xff;
+      octets[2] = (word >> 16) & 0xff;
+      octets[3] = (word >>  8) & 0xff;
+      octets[4] = (word >>  0) & 0xff;
+      fwrite (octets, 1, 5, s->file);
+      state->have_leftover_output = 0;
     }
   else
     {
-      fputc ((word >> 28) & 0xff, f);
-      fputc ((word >> 20) & 0xff, f);
-      fputc ((word >> 12) & 0xff, f);
-      fputc ((word >>  4) & 0xff, f);
-      have_leftover_output = 1;
-      leftover_output = (word << 4) & 0xf0;
+      octets[0] = (word >> 28) & 0xff;
+      octets[1] = (word >> 20) & 0xff;
+      octets[2] = (word >> 12) & 0xff;
+      octets[3] = (word >>  4) & 0xff;
+      fwrite (octets, 1, 4, s->file);
+      state->have_leftover_output = 1;
+      state->leftover_output = (word << 4) & 0xf0;
     }
 }
 
 static void
-flush_bin_word (FILE *f)
+write_bin_words (struct word_stream *s, const word_t *buffer, size_t n)
 {
-  if (have_leftover_output)
+  struct bin_state *state = s->state;
+  unsigned char octets[9 * CHUNK];
+  size_t m;
+
+  /* Finish a pair started by write_bin_word. */
+  if (state->have_leftover_output && n > 0)
     {
-      fputc (leftover_output, f);
-      have_leftover_output = 0;
+      write_bin_word (s, *buffer++);
+      n--;
     }
+
+  for (; n >= 2; n -= 2 * m, buffer += 2 * m)
+    {
+      m = n / 2 > CHUNK ? CHUNK : n / 2;
+      pack_bin_words (buffer, octets, m);
+      fwrite (octets, 9, m, s->file);
+    }
+
+  if (n > 0)
+    write_bin_word (s, *buffer);
+}
+
+static void
+flush_bin_word (struct word_stream *s)
+{
+  struct bin_state *state = s->state;
+  if (state->have_leftover_output)
+    {
+      fputc (state->leftover_output, s->file);
+      state->have_leftover_output = 0;
+    }
+}
+
+/* Every bit is used, so any octets will do, but only as a last
+   resort. */
+static int
+score_bin (const unsigned char *octets, size_t n, int whole)
+{
+  (void)octets;
+  (void)whole;
+  return n > 0 ? 10 : 0;
 }
 
 struct word_format bin_word_format = {
@@ -129,5 +248,12 @@ struct word_format bin_word_format = {
   rewind_bin_word,
   seek_bin_word,
   write_bin_word,
-  flush_bin_word
+  flush_bin_word,
+  get_bin_words,
+  write_bin_words,
+  new_bin_state,
+  NULL,
+  NULL,
+  NULL,
+  score_bin
 };
@@ -24,12 +24,15 @@
    lab PDP-10 through Unibus. */
 
 static void
-write_cadr_word (FILE *f, word_t word)
+write_cadr_word (struct word_stream *s, word_t word)
 {
-  fputc ((word >> 20) & 0377, f);
-  fputc ((word >> 28) & 0377, f);
-  fputc ((word >>  4) & 0377, f);
-  fputc ((word >> 12) & 0377, f);
+  unsigned char octets[4];
+
+  octets[0] = (word >> 20) & 0377;
+  octets[1] = (word >> 28) & 0377;
+  octets[2] = (word >>  4) & 0377;
+  octets[3] = (word >> 12) & 0377;
+  fwrite (octets, 1, 4, s->file);
 }
 
 struct word_format cadr_word_format = {
@@ -38,5 +41,12 @@ struct word_format cadr_word_format = {
   NULL,
   NULL,
   write_cadr_word,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
   NULL
 };
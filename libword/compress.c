@@ -0,0 +1,547 @@
+/* Copyright (C) 2026 Lars Brinkhoff <lars@nocrew.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Transparent decompression of gzip and xz input.  A helper thread
+   reads the compressed octets, from the file or its mapping, and
+   decodes them into a queue of blocks.  The input functions take the
+   blocks one at a time through the stream's pushback buffer. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+
+#include "libword.h"
+
+/* Size of each decoded block, and how many may be waiting. */
+#define BLOCK (256 * 1024)
+#define DEPTH 4
+
+/* Compressed octets read at a time. */
+#define CHUNK (64 * 1024)
+
+enum { GZIP, XZ };
+
+struct block {
+  unsigned char *data;
+  size_t size;
+};
+
+struct decompress {
+  int type;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /* Decoded blocks, written by the thread. */
+  struct block queue[DEPTH];
+  int head, count;
+  int done, error, stop;
+  /* Compressed input, from the file or a mapping.  The prefix holds
+     octets already taken from the file, e.g. pushed back from a pipe. */
+  FILE *file;
+  const unsigned char *map;
+  size_t map_size, map_offset;
+  unsigned char *prefix_buffer;
+  const unsigned char *prefix;
+  size_t prefix_size;
+  unsigned char chunk[CHUNK];
+  /* Where the compressed data starts, or -1 if it can't be read
+     again. */
+  long start;
+  /* The file, to tell if the FILE has been opened on another. */
+  dev_t dev;
+  ino_t ino;
+  /* Nonzero if the mapping was made just for decompressing. */
+  int mapped;
+};
+
+static const unsigned char gzip_magic[] = { 0x1F, 0x8B };
+static const unsigned char xz_magic[] = { 0xFD, '7', 'z', 'X', 'Z', 0 };
+
+/* Get more compressed input.  Return the number of octets, or 0 at
+   the end. */
+static size_t
+read_input (struct decompress *d, const unsigned char **p)
+{
+  size_t n;
+
+  if (d->prefix_size > 0)
+    {
+      *p = d->prefix;
+      n = d->prefix_size;
+      d->prefix_size = 0;
+      return n;
+    }
+
+  if (d->map != NULL)
+    {
+      *p = d->map + d->map_offset;
+      n = d->map_size - d->map_offset;
+      if (n > CHUNK)
+        n = CHUNK;
+      d->map_offset += n;
+      return n;
+    }
+
+  /* The end of the file is left for the stream to find, when the
+     decoded octets have been read. */
+  *p = d->chunk;
+  flockfile (d->file);
+  n = fread_unlocked (d->chunk, 1, CHUNK, d->file);
+  if (feof_unlocked (d->file))
+    clearerr_unlocked (d->file);
+  funlockfile (d->file);
+  return n;
+}
+
+#if defined HAVE_ZLIB || defined HAVE_LZMA
+/* Hand a full block to the reader, and wait if the queue is full.
+   Return nonzero if the reader wants the thread to stop. */
+static int
+put_block (struct decompress *d, unsigned char *data, size_t size)
+{
+  int stop;
+
+  pthread_mutex_lock (&d->lock);
+  while (d->count == DEPTH && !d->stop)
+    pthread_cond_wait (&d->cond, &d->lock);
+  stop = d->stop;
+  if (!stop && size > 0)
+    {
+      d->queue[(d->head + d->count) % DEPTH].data = data;
+      d->queue[(d->head + d->count) % DEPTH].size = size;
+      d->count++;
+      pthread_cond_broadcast (&d->cond);
+    }
+  pthread_mutex_unlock (&d->lock);
+  if (stop || size == 0)
+    free (data);
+  return stop;
+}
+
+static unsigned char *
+new_block (void)
+{
+  unsigned char *data = malloc (BLOCK);
+  if (data == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  return data;
+}
+#endif
+
+#ifdef HAVE_ZLIB
+static int
+inflate_input (struct decompress *d)
+{
+  const unsigned char *p;
+  unsigned char *out = new_block ();
+  z_stream z;
+  int ret = Z_OK;
+
+  memset (&z, 0, sizeof z);
+  if (inflateInit2 (&z, 15 + 32) != Z_OK)
+    return -1;
+  z.next_out = out;
+  z.avail_out = BLOCK;
+
+  for (;;)
+    {
+      if (z.avail_in == 0)
+        {
+          z.avail_in = read_input (d, &p);
+          z.next_in = (unsigned char *)p;
+          if (z.avail_in == 0)
+            break;
+        }
+
+      ret = inflate (&z, Z_NO_FLUSH);
+      if (ret == Z_STREAM_END)
+        {
+          /* Another member may follow; anything else is ignored, like
+             gzip does. */
+          if (z.avail_in == 0)
+            {
+              z.avail_in = read_input (d, &p);
+              z.next_in = (unsigned char *)p;
+            }
+          if (z.avail_in == 0 || z.next_in[0] != gzip_magic[0])
+            break;
+          inflateReset (&z);
+        }
+      else if (ret != Z_OK && ret != Z_BUF_ERROR)
+        break;
+
+      if (z.avail_out == 0)
+        {
+          if (put_block (d, out, BLOCK))
+            {
+              inflateEnd (&z);
+              return 0;
+            }
+          out = new_block ();
+          z.next_out = out;
+          z.avail_out = BLOCK;
+        }
+    }
+
+  put_block (d, out, BLOCK - z.avail_out);
+  inflateEnd (&z);
+  return ret == Z_STREAM_END ? 0 : -1;
+}
+#endif
+
+#ifdef HAVE_LZMA
+static int
+unxz_input (struct decompress *d)
+{
+  lzma_stream z = LZMA_STREAM_INIT;
+  lzma_action action = LZMA_RUN;
+  const unsigned char *p;
+  unsigned char *out = new_block ();
+  lzma_ret ret;
+
+  if (lzma_stream_decoder (&z, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK)
+    return -1;
+  z.next_out = out;
+  z.avail_out = BLOCK;
+
+  for (;;)
+    {
+      if (z.avail_in == 0 && action == LZMA_RUN)
+        {
+          z.avail_in = read_input (d, &p);
+          z.next_in = p;
+          if (z.avail_in == 0)
+            action = LZMA_FINISH;
+        }
+
+      ret = lzma_code (&z, action);
+      if (ret != LZMA_OK)
+        break;
+
+      if (z.avail_out == 0)
+        {
+          if (put_block (d, out, BLOCK))
+            {
+              lzma_end (&z);
+              return 0;
+            }
+          out = new_block ();
+          z.next_out = out;
+          z.avail_out = BLOCK;
+        }
+    }
+
+  put_block (d, out, BLOCK - z.avail_out);
+  lzma_end (&z);
+  return ret == LZMA_STREAM_END ? 0 : -1;
+}
+#endif
+
+static void *
+decompress_thread (void *arg)
+{
+  struct decompress *d = arg;
+  const unsigned char *p;
+  int error = -1;
+
+  switch (d->type)
+    {
+#ifdef HAVE_ZLIB
+    case GZIP: error = inflate_input (d); break;
+#endif
+#ifdef HAVE_LZMA
+    case XZ: error = unxz_input (d); break;
+#endif
+    }
+
+  /* Skip anything after the compressed data, so the stream ends up at
+     the end of the file. */
+  pthread_mutex_lock (&d->lock);
+  if (!d->stop && !error)
+    {
+      pthread_mutex_unlock (&d->lock);
+      while (read_input (d, &p) > 0)
+        ;
+      pthread_mutex_lock (&d->lock);
+    }
+  d->done = 1;
+  d->error = error;
+  pthread_cond_broadcast (&d->cond);
+  pthread_mutex_unlock (&d->lock);
+  return NULL;
+}
+
+static void
+start_thread (struct decompress *d)
+{
+  d->head = d->count = 0;
+  d->done = d->error = d->stop = 0;
+  if (pthread_create (&d->thread, NULL, decompress_thread, d) != 0)
+    {
+      fprintf (stderr, "Can't start decompression thread.\n");
+      exit (1);
+    }
+}
+
+static void
+stop_thread (struct decompress *d)
+{
+  pthread_mutex_lock (&d->lock);
+  d->stop = 1;
+  pthread_cond_broadcast (&d->cond);
+  pthread_mutex_unlock (&d->lock);
+  pthread_join (d->thread, NULL);
+  while (d->count > 0)
+    {
+      free (d->queue[d->head].data);
+      d->head = (d->head + 1) % DEPTH;
+      d->count--;
+    }
+}
+
+/* Take the next decoded block from the queue, waiting for it if
+   necessary.  Return zero at the end of the input. */
+static int
+get_block (struct decompress *d, struct block *b)
+{
+  pthread_mutex_lock (&d->lock);
+  while (d->count == 0 && !d->done)
+    pthread_cond_wait (&d->cond, &d->lock);
+  if (d->count == 0)
+    {
+      pthread_mutex_unlock (&d->lock);
+      if (d->error)
+        {
+          fprintf (stderr, "Error in compressed input.\n");
+          exit (1);
+        }
+      return 0;
+    }
+  *b = d->queue[d->head];
+  d->head = (d->head + 1) % DEPTH;
+  d->count--;
+  pthread_cond_broadcast (&d->cond);
+  pthread_mutex_unlock (&d->lock);
+  return 1;
+}
+
+/* At the end of the decoded octets, leave the stream reading at the
+   end of the compressed ones.  The decompression is kept around, in
+   case the stream is rewound. */
+static void
+end_of_decompressed (struct word_stream *s)
+{
+  struct decompress *d = s->decompress;
+  if (d->map != NULL)
+    s->map_offset = d->map_offset;
+}
+
+/* Replace the used up pushback buffer with the next decoded block.
+   Return zero at the end of the input. */
+int
+next_decompressed (struct word_stream *s)
+{
+  struct block b;
+
+  if (!get_block (s->decompress, &b))
+    {
+      end_of_decompressed (s);
+      return 0;
+    }
+
+  free (s->peek);
+  s->peek = b.data;
+  s->peek_base += s->peek_size;
+  s->peek_size = b.size;
+  s->peek_offset = 0;
+  return 1;
+}
+
+/* Add the next decoded block to the end of the pushback buffer. */
+int
+append_decompressed (struct word_stream *s)
+{
+  unsigned char *peek;
+  struct block b;
+
+  if (!get_block (s->decompress, &b))
+    {
+      end_of_decompressed (s);
+      return 0;
+    }
+
+  peek = realloc (s->peek, s->peek_size + b.size);
+  if (peek == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  memcpy (peek + s->peek_size, b.data, b.size);
+  free (b.data);
+  s->peek = peek;
+  s->peek_size += b.size;
+  return 1;
+}
+
+/* Start over from the beginning of the compressed data.  Return zero
+   if it can't be read again. */
+int
+restart_decompress (struct word_stream *s)
+{
+  struct decompress *d = s->decompress;
+
+  if (d->start == -1)
+    return 0;
+  stop_thread (d);
+  d->prefix_size = 0;
+  if (d->map != NULL)
+    d->map_offset = d->start;
+  else
+    {
+      fseek (d->file, d->start, SEEK_SET);
+      clearerr (d->file);
+    }
+  drop_peek (s);
+  s->peek_base = 0;
+  start_thread (d);
+  next_decompressed (s);
+  return 1;
+}
+
+/* If the stream starts with compressed data, decompress it from now
+   on.  Return nonzero if so. */
+int
+start_decompress (struct word_stream *s)
+{
+  const unsigned char *p;
+  struct decompress *d;
+  struct stat st;
+  size_t n;
+  int type;
+
+  if (s->decompress != NULL)
+    {
+      d = s->decompress;
+      if (fstat (fileno (s->file), &st) == 0
+          && st.st_dev == d->dev && st.st_ino == d->ino)
+        return 1;
+      end_decompress (s);
+      drop_peek (s);
+    }
+
+  p = stream_peek (s, sizeof xz_magic, &n);
+  if (n >= sizeof gzip_magic && memcmp (p, gzip_magic, sizeof gzip_magic) == 0)
+    type = GZIP;
+  else if (n >= sizeof xz_magic && memcmp (p, xz_magic, sizeof xz_magic) == 0)
+    type = XZ;
+  else
+    return 0;
+
+#ifndef HAVE_ZLIB
+  if (type == GZIP)
+    {
+      fprintf (stderr, "Input is gzip compressed, but zlib support is missing.\n");
+      exit (1);
+    }
+#endif
+#ifndef HAVE_LZMA
+  if (type == XZ)
+    {
+      fprintf (stderr, "Input is xz compressed, but liblzma support is missing.\n");
+      exit (1);
+    }
+#endif
+
+  d = calloc (1, sizeof *d);
+  if (d == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  d->type = type;
+  pthread_mutex_init (&d->lock, NULL);
+  pthread_cond_init (&d->cond, NULL);
+  if (fstat (fileno (s->file), &st) == 0)
+    {
+      d->dev = st.st_dev;
+      d->ino = st.st_ino;
+    }
+
+  /* Take over the octets from wherever the stream was reading.  A
+     regular file is mapped, so the thread never touches the FILE,
+     which may be closed before all of it is read. */
+  if (s->map == NULL)
+    d->mapped = map_word_stream (s);
+  if (s->map != NULL)
+    {
+      d->map = s->map;
+      d->map_size = s->map_size;
+      d->start = d->map_offset = s->map_offset;
+    }
+  else
+    {
+      d->file = s->file;
+      d->start = ftell (s->file) == -1 ? -1 : stream_tell (s);
+      d->prefix_buffer = s->peek;
+      d->prefix = s->peek + s->peek_offset;
+      d->prefix_size = s->peek_size - s->peek_offset;
+      s->peek = NULL;
+    }
+  drop_peek (s);
+  s->peek_base = 0;
+
+  s->decompress = d;
+  start_thread (d);
+  next_decompressed (s);
+  return 1;
+}
+
+/* Stop decompressing.  The file or mapping is left where the thread
+   stopped reading it. */
+void
+end_decompress (struct word_stream *s)
+{
+  struct decompress *d = s->decompress;
+
+  if (d == NULL)
+    return;
+  stop_thread (d);
+  if (d->mapped)
+    {
+      /* The FILE may be gone, so leave it alone. */
+      munmap ((void *)s->map, s->map_size);
+      s->map = NULL;
+    }
+  else if (d->map != NULL)
+    s->map_offset = d->map_offset;
+  free (d->prefix_buffer);
+  pthread_mutex_destroy (&d->lock);
+  pthread_cond_destroy (&d->cond);
+  free (d);
+  s->decompress = NULL;
+}
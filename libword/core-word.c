@@ -14,48 +14,127 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "libword.h"
 
+/* Number of words decoded from each read. */
+#define CHUNK 1024
+
 static int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c = stream_getc (s);
   return c == EOF ? 0 : c;
 }
 
-word_t
-get_core_word (FILE *f)
+static word_t
+get_core (struct word_stream *s)
 {
   word_t word;
 
-  if (feof (f))
+  if (stream_eof (s))
     return -1;
 
-  word = ((word_t)get_byte (f) << 28) |
-         ((word_t)get_byte (f) << 20) |
-         ((word_t)get_byte (f) << 12) |
-         ((word_t)get_byte (f) <<  4) |
-          (word_t)get_byte (f);
+  word = ((word_t)get_byte (s) << 28) |
+         ((word_t)get_byte (s) << 20) |
+         ((word_t)get_byte (s) << 12) |
+         ((word_t)get_byte (s) <<  4) |
+          (word_t)get_byte (s);
 
   return word;
 }
 
+word_t
+get_core_word (FILE *f)
+{
+  struct word_stream s;
+  init_word_stream (&s, f, &core_word_format);
+  return get_core (&s);
+}
+
+static size_t
+get_core_words (struct word_stream *s, word_t *buffer, size_t n)
+{
+  unsigned char octets[5 * CHUNK];
+  const unsigned char *p;
+  size_t m, got, count = 0;
+
+  while (count < n && !stream_eof (s))
+    {
+      m = n - count;
+      if (m > CHUNK)
+        m = CHUNK;
+      p = stream_octets (s, octets, 5 * m, &got);
+      if (got < 5 * m)
+        {
+          /* Like get_core, the word where the file ends is padded
+             with zeros. */
+          memmove (octets, p, got);
+          memset (octets + got, 0, 5 * m - got);
+          unpack_core_words (octets, buffer + count, got / 5 + 1);
+          return count + got / 5 + 1;
+        }
+      unpack_core_words (p, buffer + count, m);
+      count += m;
+    }
+
+  return count;
+}
+
 void
 write_core_word (FILE *f, word_t word)
 {
-  fputc ((word >> 28) & 0xFF, f);
-  fputc ((word >> 20) & 0xFF, f);
-  fputc ((word >> 12) & 0xFF, f);
-  fputc ((word >>  4) & 0xFF, f);
-  fputc ( word        & 0x0F, f);
+  unsigned char octets[5];
+  pack_core_words (&word, octets, 1);
+  fwrite (octets, 1, 5, f);
+}
+
+static void
+write_core (struct word_stream *s, word_t word)
+{
+  write_core_word (s->file, word);
+}
+
+static void
+write_core_words (struct word_stream *s, const word_t *buffer, size_t n)
+{
+  unsigned char octets[5 * CHUNK];
+  size_t m;
+
+  for (; n > 0; n -= m, buffer += m)
+    {
+      m = n > CHUNK ? CHUNK : n;
+      pack_core_words (buffer, octets, m);
+      fwrite (octets, 5, m, s->file);
+    }
+}
+
+/* The last octet of a word only has four bits. */
+static int
+score_core (const unsigned char *octets, size_t n, int whole)
+{
+  size_t i, good = 0;
+
+  (void)whole;
+  for (i = 0; i + 5 <= n; i += 5)
+    if ((octets[i + 4] & 0xF0) == 0)
+      good++;
+  return word_score (good, n / 5, 1.0 / 16);
 }
 
 struct word_format core_word_format = {
   "core",
-  get_core_word,
+  get_core,
   NULL,
   by_five_octets,
-  write_core_word,
-  NULL
+  write_core,
+  NULL,
+  get_core_words,
+  write_core_words,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  score_core
 };
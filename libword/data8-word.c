@@ -18,15 +18,18 @@
 #include <stdio.h>
 #include "libword.h"
 
+/* Number of words decoded from each read. */
+#define CHUNK 1024
+
 static word_t
-get_data8_word (FILE *f)
+get_data8_word (struct word_stream *s)
 {
   word_t word = 0;
   int c, i;
 
   for (i = 0; i < 64; i += 8)
     {
-      c = fgetc (f);
+      c = stream_getc (s);
       if (c == EOF)
         return -1;
       word |= (word_t)(c & 0xff) << i;
@@ -38,17 +41,76 @@ get_data8_word (FILE *f)
   return word;
 }
 
+static size_t
+get_data8_words (struct word_stream *s, word_t *buffer, size_t n)
+{
+  unsigned char octets[8 * CHUNK];
+  const unsigned char *p;
+  size_t i, m, got, count = 0;
+  word_t word;
+
+  while (count < n)
+    {
+      m = n - count;
+      if (m > CHUNK)
+        m = CHUNK;
+      p = stream_octets (s, octets, 8 * m, &got);
+      if (!unpack_data8_words (p, buffer + count, got / 8))
+        count += got / 8;
+      else
+        {
+          /* Go back and complain about the bad words. */
+          for (i = 0; i < got / 8; i++)
+            {
+              word = buffer[count];
+              if (word & 0xFFFFFFF000000000LL)
+                fprintf (stderr, "WARNING: garbage in data8 word: %012llo.\n", word);
+              if (word == -1)
+                return count;
+              count++;
+            }
+        }
+      if (got < 8 * m)
+        break;
+    }
+
+  return count;
+}
+
+static void
+write_data8_word (struct word_stream *s, word_t word)
+{
+  unsigned char octets[8];
+  pack_data8_words (&word, octets, 1);
+  fwrite (octets, 1, 8, s->file);
+}
+
 static void
-write_data8_word (FILE *f, word_t word)
+write_data8_words (struct word_stream *s, const word_t *buffer, size_t n)
 {
-  fputc ((word >>  0) & 0xff, f);
-  fputc ((word >>  8) & 0xff, f);
-  fputc ((word >> 16) & 0xff, f);
-  fputc ((word >> 24) & 0xff, f);
-  fputc ((word >> 32) & 0xff, f);
-  fputc (0, f);
-  fputc (0, f);
-  fputc (0, f);
+  unsigned char octets[8 * CHUNK];
+  size_t m;
+
+  for (; n > 0; n -= m, buffer += m)
+    {
+      m = n > CHUNK ? CHUNK : n;
+      pack_data8_words (buffer, octets, m);
+      fwrite (octets, 8, m, s->file);
+    }
+}
+
+/* The top 28 bits of each 64-bit word are zero. */
+static int
+score_data8 (const unsigned char *octets, size_t n, int whole)
+{
+  size_t i, good = 0;
+
+  (void)whole;
+  for (i = 0; i + 8 <= n; i += 8)
+    if ((octets[i + 4] & 0xF0) == 0
+        && (octets[i + 5] | octets[i + 6] | octets[i + 7]) == 0)
+      good++;
+  return word_score (good, n / 8, 1.0 / (1 << 28));
 }
 
 struct word_format data8_word_format = {
@@ -57,5 +119,12 @@ struct word_format data8_word_format = {
   NULL,
   by_eight_octets,
   write_data8_word,
-  NULL
+  NULL,
+  get_data8_words,
+  write_data8_words,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  score_data8
 };
@@ -14,73 +14,177 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "libword.h"
 
-static int position = 0;
+/* Number of words decoded from each read. */
+#define CHUNK 1024
+
+struct dta_state {
+  int position;
+};
+
+static void *
+new_dta_state (void)
+{
+  return new_word_state (sizeof (struct dta_state));
+}
 
 static void
-rewind_dta_word (FILE *f)
+rewind_dta_word (struct word_stream *s)
 {
-  position = 0;
-  rewind (f);
+  struct dta_state *state = s->state;
+  state->position = 0;
+  stream_rewind (s);
+}
+
+static void
+seek_dta_word (struct word_stream *s, int position)
+{
+  struct dta_state *state = s->state;
+  by_eight_octets (s, position);
+  state->position = position;
 }
 
 static inline int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c = stream_getc (s);
   return c == EOF ? 0 : c;
 }
 
 static inline word_t
-get_half (FILE *f)
+get_half (struct word_stream *s)
 {
-  return (get_byte (f)
-	  + (get_byte (f) << 8)
-	  + (get_byte (f) << 16)
-	  + (get_byte (f) << 24));
+  return (get_byte (s)
+	  + (get_byte (s) << 8)
+	  + (get_byte (s) << 16)
+	  + (get_byte (s) << 24));
 }
 
 static word_t
-get_dta_word (FILE *f)
+get_dta_word (struct word_stream *s)
 {
+  struct dta_state *state = s->state;
   word_t word;
 
-  if (feof (f))
+  if (stream_eof (s))
     return -1;
 
-  word = (get_half (f) << 18);
-  word += get_half (f);
+  word = (get_half (s) << 18);
+  word += get_half (s);
 
-  if ((position % 128) == 0)
+  if ((state->position % 128) == 0)
     word |= START_RECORD;
 
-  position++;
+  state->position++;
   return word;
 }
 
+static inline word_t
+unpack_half (const unsigned char *p)
+{
+  return p[0] + (p[1] << 8) + (p[2] << 16) + (p[3] << 24);
+}
+
+static size_t
+get_dta_words (struct word_stream *s, word_t *buffer, size_t n)
+{
+  struct dta_state *state = s->state;
+  unsigned char octets[8 * CHUNK];
+  const unsigned char *p;
+  size_t i, m, got, count = 0;
+  word_t word;
+
+  while (count < n && !stream_eof (s))
+    {
+      m = n - count;
+      if (m > CHUNK)
+        m = CHUNK;
+      p = stream_octets (s, octets, 8 * m, &got);
+      if (got < 8 * m)
+        {
+          /* Like get_dta_word, pad the word where the file ends. */
+          memmove (octets, p, got);
+          memset (octets + got, 0, 8 * m - got);
+          p = octets;
+          m = got / 8 + 1;
+          n = count + m;
+        }
+      for (i = 0; i < m; i++, p += 8)
+        {
+          word = (unpack_half (p) << 18);
+          word += unpack_half (p + 4);
+          if ((state->position % 128) == 0)
+            word |= START_RECORD;
+          state->position++;
+          buffer[count++] = word;
+        }
+    }
+
+  return count;
+}
+
+static inline void
+pack_half (unsigned char *p, int half)
+{
+  p[0] = half & 0377;
+  p[1] = (half >> 8) & 0377;
+  p[2] = (half >> 16) & 0377;
+  p[3] = (half >> 24) & 0377;
+}
+
+static void
+write_dta_words (struct word_stream *s, const word_t *buffer, size_t n)
+{
+  unsigned char octets[8 * CHUNK], *p;
+  size_t i, m;
+
+  for (; n > 0; n -= m, buffer += m)
+    {
+      m = n > CHUNK ? CHUNK : n;
+      for (i = 0, p = octets; i < m; i++, p += 8)
+        {
+          pack_half (p, (buffer[i] >> 18) & 0777777);
+          pack_half (p + 4, buffer[i] & 0777777);
+        }
+      fwrite (octets, 8, m, s->file);
+    }
+}
+
 static void
-write_half (FILE *f, int word)
+write_dta_word (struct word_stream *s, word_t word)
 {
-  fputc (word & 0377, f);
-  fputc ((word >> 8) & 0377, f);
-  fputc ((word >> 16) & 0377, f);
-  fputc ((word >> 24) & 0377, f);
+  write_dta_words (s, &word, 1);
 }
 
-void
-write_dta_word (FILE *f, word_t word)
+/* Each half word is stored in 32 bits, the top 14 of them zero. */
+static int
+score_dta (const unsigned char *octets, size_t n, int whole)
 {
-  write_half (f, (word >> 18) & 0777777);
-  write_half (f, word & 0777777);
+  size_t i, good = 0;
+
+  (void)whole;
+  for (i = 0; i + 8 <= n; i += 8)
+    if (((octets[i + 2] | octets[i + 6]) & 0xFC) == 0
+        && (octets[i + 3] | octets[i + 7]) == 0)
+      good++;
+  return word_score (good, n / 8, 1.0 / (1 << 28));
 }
 
 struct word_format dta_word_format = {
   "dta",
   get_dta_word,
   rewind_dta_word,
-  by_eight_octets,
+  seek_dta_word,
   write_dta_word,
-  NULL
+  NULL,
+  get_dta_words,
+  write_dta_words,
+  new_dta_state,
+  NULL,
+  NULL,
+  NULL,
+  score_dta
 };
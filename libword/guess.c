@@ -0,0 +1,188 @@
+/* Copyright (C) 2026 Lars Brinkhoff <lars@nocrew.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Guess the word format of an input file.  The first octets of the
+   file are read once, and every format with a score function rates
+   how plausible they are, each in its own thread.  The best score
+   wins, and ties go to the format listed first below. */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "libword.h"
+
+/* Octets to look at. */
+#define GUESS_OCTETS (64 * 1024)
+
+/* Below this, the guess is reported as uncertain. */
+#define CONFIDENT 50
+
+/* A stream starts out in this format, and the first read replaces it
+   with a guess. */
+struct word_format auto_word_format = {
+  "auto",
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL,
+  NULL
+};
+
+/* Most structured first, so that e.g. a tape image full of core
+   words is taken for a tape. */
+static struct word_format *candidates[] = {
+  &tape_word_format,
+  &tape7_word_format,
+  &oct_word_format,
+  &data8_word_format,
+  &dta_word_format,
+  &pt_word_format,
+  &its_word_format,
+  &sail_word_format,
+  &core_word_format,
+  &alto_word_format,
+  &aa_word_format,
+  &bin_word_format,
+  NULL
+};
+
+#define CANDIDATES (sizeof candidates / sizeof candidates[0] - 1)
+
+/* These decoders give up on octets not in the format, so they are
+   only used if the guess is good. */
+static struct word_format *strict[] = {
+  &tape_word_format,
+  &tape7_word_format,
+  &its_word_format,
+  &sail_word_format,
+  NULL
+};
+
+struct candidate {
+  struct word_format *format;
+  const unsigned char *octets;
+  size_t n;
+  int whole;
+  int score;
+};
+
+/* Turn a count of good units out of a total into a score from 0 to
+   100, where 0 means no better than random octets, which are good
+   with probability chance. */
+int
+word_score (size_t good, size_t total, double chance)
+{
+  double x;
+
+  if (total == 0)
+    return 0;
+  x = ((double)good / total - chance) / (1.0 - chance);
+  if (x <= 0.0)
+    return 0;
+  return (int)(100.0 * x);
+}
+
+static void *
+score_candidate (void *arg)
+{
+  struct candidate *c = arg;
+  c->score = c->format->score (c->octets, c->n, c->whole);
+  return NULL;
+}
+
+static int
+is_strict (struct word_format *format)
+{
+  int i;
+  for (i = 0; strict[i] != NULL; i++)
+    if (format == strict[i])
+      return 1;
+  return 0;
+}
+
+/* Guess the format of n octets, which are the whole file if whole is
+   nonzero, or else the start of it. */
+struct word_format *
+guess_word_format (const unsigned char *octets, size_t n, int whole,
+                   int *confidence)
+{
+  struct candidate c[CANDIDATES];
+  pthread_t thread[CANDIDATES];
+  int started[CANDIDATES];
+  size_t i, best;
+
+  for (i = 0; i < CANDIDATES; i++)
+    {
+      c[i].format = candidates[i];
+      c[i].octets = octets;
+      c[i].n = n;
+      c[i].whole = whole;
+      started[i] = pthread_create (&thread[i], NULL, score_candidate, &c[i]) == 0;
+      if (!started[i])
+        score_candidate (&c[i]);
+    }
+
+  best = 0;
+  for (i = 0; i < CANDIDATES; i++)
+    {
+      if (started[i])
+        pthread_join (thread[i], NULL);
+      if (c[i].score > c[best].score)
+        best = i;
+    }
+
+  /* An uncertain guess had better not exit on the first bad word. */
+  if (c[best].score < CONFIDENT && is_strict (c[best].format))
+    {
+      for (best = 0; is_strict (c[best].format); best++)
+        ;
+      for (i = best + 1; i < CANDIDATES; i++)
+        if (!is_strict (c[i].format) && c[i].score > c[best].score)
+          best = i;
+    }
+
+  if (confidence != NULL)
+    *confidence = c[best].score;
+  return c[best].format;
+}
+
+/* Replace the auto format of a stream with a guess based on what
+   comes next in the file.  The octets are left for the guessed format
+   to read. */
+void
+guess_word_stream (struct word_stream *s)
+{
+  struct word_format *format;
+  const unsigned char *octets;
+  size_t n;
+  int confidence;
+
+  octets = stream_peek (s, GUESS_OCTETS, &n);
+  format = guess_word_format (octets, n, n < GUESS_OCTETS, &confidence);
+
+  if (n > 0 && confidence < CONFIDENT)
+    fprintf (stderr, "WARNING: guessed word format %s with %d%% confidence.\n",
+             format->name, confidence);
+
+  s->format = format;
+  s->state = format->new_state == NULL ? NULL : format->new_state ();
+}
@@ -0,0 +1,403 @@
+/* Copyright (C) 2026 Lars Brinkhoff <lars@nocrew.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Input octets for the word formats.  They come from the stream's
+   file through stdio, or if the file has been mapped into memory,
+   straight from there.  The functions behave like their stdio
+   counterparts, including setting the end of file indicator only when
+   trying to read past the end.
+
+   Octets looked at with stream_peek are read again from a pushback
+   buffer if the file can't seek back over them, like a pipe.  If the
+   buffer holds the start of the file, rewinding works until reading
+   goes past the end of it.
+
+   Compressed input is decoded into the pushback buffer one block at a
+   time, see compress.c. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "libword.h"
+
+/* Stop reading from the pushback buffer. */
+void
+drop_peek (struct word_stream *s)
+{
+  free (s->peek);
+  s->peek = NULL;
+  s->peek_size = s->peek_offset = 0;
+}
+
+/* Return a pointer to the next n octets, or fewer at the end of the
+   file, and the number in *got, without consuming them.  The pointer
+   is good until the next read from the stream. */
+const unsigned char *
+stream_peek (struct word_stream *s, size_t n, size_t *got)
+{
+  unsigned char *peek;
+  size_t have;
+  long offset;
+  int eof;
+
+  if (s->decompress != NULL)
+    {
+      have = s->peek_size - s->peek_offset;
+      if (have < n && s->peek_offset > 0)
+        {
+          memmove (s->peek, s->peek + s->peek_offset, have);
+          s->peek_base += s->peek_offset;
+          s->peek_size = have;
+          s->peek_offset = 0;
+        }
+      while (have < n && append_decompressed (s))
+        have = s->peek_size;
+      *got = have < n ? have : n;
+      return s->peek + s->peek_offset;
+    }
+
+  if (s->map != NULL)
+    {
+      *got = s->map_offset < s->map_size ? s->map_size - s->map_offset : 0;
+      if (*got > n)
+        *got = n;
+      return s->map + s->map_offset;
+    }
+
+  /* Read more after what is already pushed back, first dropping what
+     has been read. */
+  have = s->peek_size - s->peek_offset;
+  if (have < n)
+    {
+      if (s->peek_offset > 0)
+        {
+          memmove (s->peek, s->peek + s->peek_offset, have);
+          if (s->peek_base != -1)
+            s->peek_base += s->peek_offset;
+          s->peek_size = have;
+          s->peek_offset = 0;
+        }
+      peek = realloc (s->peek, n);
+      if (peek == NULL)
+        {
+          fprintf (stderr, "Out of memory.\n");
+          exit (1);
+        }
+      s->peek = peek;
+      offset = s->peek_size > 0 ? -1 : ftell (s->file);
+      eof = feof (s->file);
+      have += fread (peek + s->peek_size, 1, n - have, s->file);
+
+      /* Seek back if possible, or else push back.  Seeking forgets
+         about the end of the file, so find it again. */
+      if (offset != -1 && fseek (s->file, offset, SEEK_SET) == 0)
+        {
+          s->peek_size = s->peek_offset = 0;
+          if (eof)
+            fgetc (s->file);
+        }
+      else
+        {
+          if (s->peek_size == 0)
+            s->peek_base = offset != -1 ? offset : s->position == 0 ? 0 : -1;
+          s->peek_size = s->peek_offset + have;
+          if (!eof)
+            clearerr (s->file);
+        }
+    }
+
+  *got = have < n ? have : n;
+  return s->peek + s->peek_offset;
+}
+
+/* The pushback buffer is used up; go on with the next decoded block,
+   or else the file. */
+static int
+peek_done (struct word_stream *s)
+{
+  if (s->peek_offset < s->peek_size)
+    return 0;
+  if (s->decompress != NULL && next_decompressed (s))
+    return 0;
+  drop_peek (s);
+  return 1;
+}
+
+/* Map the rest of the stream's file into memory, if it's a regular
+   file.  Pipes and terminals are left to stdio.  Return nonzero if
+   the file was mapped. */
+int
+map_word_stream (struct word_stream *s)
+{
+  struct stat st;
+  long offset;
+  void *map;
+
+  if (s->map != NULL)
+    return 1;
+  if (s->decompress != NULL)
+    return 0;
+  if (fstat (fileno (s->file), &st) == -1 || !S_ISREG (st.st_mode)
+      || st.st_size == 0 || (offset = stream_tell (s)) == -1)
+    return 0;
+
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno (s->file), 0);
+  if (map == MAP_FAILED)
+    return 0;
+  madvise (map, st.st_size, MADV_SEQUENTIAL);
+
+  drop_peek (s);
+  s->map = map;
+  s->map_size = st.st_size;
+  s->map_offset = offset;
+  s->map_eof = 0;
+  return 1;
+}
+
+/* Stop using the mapping, and leave the file where the stream was. */
+void
+unmap_word_stream (struct word_stream *s)
+{
+  end_decompress (s);
+  if (s->map == NULL)
+    return;
+
+  munmap ((void *)s->map, s->map_size);
+  s->map = NULL;
+  fseek (s->file, s->map_offset, SEEK_SET);
+  if (s->map_eof)
+    fgetc (s->file);
+}
+
+int
+map_word_file (FILE *f)
+{
+  return map_word_stream (input_word_stream (f));
+}
+
+void
+unmap_word_file (FILE *f)
+{
+  unmap_word_stream (input_word_stream (f));
+}
+
+int
+stream_getc (struct word_stream *s)
+{
+  if (s->peek_size != 0 && !peek_done (s))
+    return s->peek[s->peek_offset++];
+  if (s->map == NULL)
+    return fgetc (s->file);
+  if (s->map_offset < s->map_size)
+    return s->map[s->map_offset++];
+  s->map_eof = 1;
+  return EOF;
+}
+
+int
+stream_eof (struct word_stream *s)
+{
+  if (s->decompress != NULL && s->peek_size != 0)
+    return 0;
+  if (s->map == NULL)
+    return feof (s->file);
+  return s->map_eof;
+}
+
+/* Return a pointer to the next n octets, or fewer at the end of the
+   file, and the number in *got.  Without a mapping they are read into
+   buffer, which must have room for n. */
+const unsigned char *
+stream_octets (struct word_stream *s, void *buffer, size_t n, size_t *got)
+{
+  const unsigned char *p;
+  size_t have;
+
+  if (s->peek_size != 0 && !peek_done (s))
+    {
+      p = s->peek + s->peek_offset;
+      have = s->peek_size - s->peek_offset;
+      if (n <= have)
+        {
+          s->peek_offset += n;
+          *got = n;
+          return p;
+        }
+      /* Gather the octets from successive blocks, and then the file. */
+      *got = 0;
+      do
+        {
+          have = s->peek_size - s->peek_offset;
+          if (have > n - *got)
+            have = n - *got;
+          memcpy ((unsigned char *)buffer + *got, s->peek + s->peek_offset, have);
+          s->peek_offset += have;
+          *got += have;
+        }
+      while (*got < n && !peek_done (s));
+      if (*got < n)
+        *got += stream_read (s, (unsigned char *)buffer + *got, n - *got);
+      return buffer;
+    }
+
+  if (s->map == NULL)
+    {
+      *got = fread (buffer, 1, n, s->file);
+      return buffer;
+    }
+
+  p = s->map + s->map_offset;
+  if (s->map_offset + n > s->map_size)
+    {
+      n = s->map_offset < s->map_size ? s->map_size - s->map_offset : 0;
+      s->map_eof = 1;
+    }
+  s->map_offset += n;
+  *got = n;
+  return p;
+}
+
+size_t
+stream_read (struct word_stream *s, void *buffer, size_t n)
+{
+  const unsigned char *p;
+  size_t got;
+
+  p = stream_octets (s, buffer, n, &got);
+  if (p != buffer)
+    memcpy (buffer, p, got);
+  return got;
+}
+
+/* Like fgets. */
+char *
+stream_gets (struct word_stream *s, char *buffer, int size)
+{
+  const unsigned char *p, *end;
+  size_t n;
+
+  if (s->peek_size != 0 && !peek_done (s))
+    {
+      p = s->peek + s->peek_offset;
+      n = s->peek_size - s->peek_offset;
+      if (n > (size_t)size - 1)
+        n = size - 1;
+      end = memchr (p, '\n', n);
+      if (end != NULL)
+        n = end - p + 1;
+      memcpy (buffer, p, n);
+      buffer[n] = 0;
+      s->peek_offset += n;
+      /* A line continuing after the pushback. */
+      if (end == NULL && n < (size_t)size - 1)
+        stream_gets (s, buffer + n, size - n);
+      return buffer;
+    }
+
+  if (s->map == NULL)
+    return fgets (buffer, size, s->file);
+
+  if (s->map_offset >= s->map_size)
+    {
+      s->map_eof = 1;
+      return NULL;
+    }
+
+  p = s->map + s->map_offset;
+  n = s->map_size - s->map_offset;
+  if (n > (size_t)size - 1)
+    n = size - 1;
+  end = memchr (p, '\n', n);
+  if (end != NULL)
+    n = end - p + 1;
+  else if (s->map_offset + n == s->map_size)
+    s->map_eof = 1;
+
+  memcpy (buffer, p, n);
+  buffer[n] = 0;
+  s->map_offset += n;
+  return buffer;
+}
+
+void
+stream_rewind (struct word_stream *s)
+{
+  if (s->decompress != NULL)
+    stream_seek (s, 0);
+  else if (s->peek_size != 0 && s->peek_base == 0)
+    s->peek_offset = 0;
+  else if (s->map == NULL)
+    {
+      drop_peek (s);
+      rewind (s->file);
+    }
+  else
+    {
+      s->map_offset = 0;
+      s->map_eof = 0;
+    }
+}
+
+/* Move to an offset in the decoded octets.  Going back means decoding
+   again from the start. */
+static void
+seek_decompressed (struct word_stream *s, long offset)
+{
+  if ((s->peek_size == 0 || offset < s->peek_base) && !restart_decompress (s))
+    {
+      fprintf (stderr, "Can't seek back in compressed input.\n");
+      exit (1);
+    }
+  while (offset > s->peek_base + (long)s->peek_size)
+    {
+      s->peek_offset = s->peek_size;
+      if (peek_done (s))
+        return;
+    }
+  s->peek_offset = offset - s->peek_base;
+}
+
+void
+stream_seek (struct word_stream *s, long offset)
+{
+  if (s->decompress != NULL)
+    seek_decompressed (s, offset);
+  else if (s->peek_size != 0 && s->peek_base != -1 && offset >= s->peek_base
+      && offset <= s->peek_base + (long)s->peek_size)
+    s->peek_offset = offset - s->peek_base;
+  else if (s->map == NULL)
+    {
+      drop_peek (s);
+      fseek (s->file, offset, SEEK_SET);
+    }
+  else
+    {
+      s->map_offset = offset;
+      s->map_eof = 0;
+    }
+}
+
+long
+stream_tell (struct word_stream *s)
+{
+  if (s->peek_size != 0)
+    return s->peek_base == -1 ? -1 : s->peek_base + (long)s->peek_offset;
+  if (s->map == NULL)
+    return ftell (s->file);
+  return s->map_offset;
+}
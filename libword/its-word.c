@@ -17,123 +17,156 @@
 #include <stdlib.h>
 #include "libword.h"
 
-static int leftover, there_is_some_leftover = 0;
-static word_t output = -1;
-
-static void write_its_word (FILE *f, word_t word);
+struct its_state {
+  /* Input. */
+  int leftover, there_is_some_leftover;
+  int format_error;
+  /* Output. */
+  word_t output;
+  int previous;
+};
 
 #define WORDMASK	(0777777777777LL)
 #define SIGNBIT		(0400000000000LL)
 
+/* Each octet in the file decodes to one or two 7-bit characters, or
+   starts a binary word.  The table holds the number of bits to insert,
+   zero for binary, and the characters themselves. */
+static unsigned char decode_bits[256];
+static unsigned short decode_chars[256];
+
+static void
+decode_entry (int octet, int c1, int c2)
+{
+  if (c2 < 0)
+    {
+      decode_bits[octet] = 7;
+      decode_chars[octet] = c1;
+    }
+  else
+    {
+      decode_bits[octet] = 14;
+      decode_chars[octet] = (c1 << 7) | c2;
+    }
+}
+
+static void
+init_decode_table (void)
+{
+  int i;
+
+  for (i = 0; i <= 0176; i++)
+    decode_entry (i, i, -1);
+  decode_entry (012, 015, 012);
+  decode_entry (015, 012, -1);
+  decode_entry (0177, 0177, 7);
+  for (i = 0200; i <= 0355; i++)
+    decode_entry (i, 0177, i - 0200);
+  decode_entry (0207, 0177, 0177);
+  decode_entry (0212, 0177, 015);
+  decode_entry (0215, 0177, 012);
+  decode_entry (0356, 015, -1);
+  decode_entry (0357, 0177, -1);
+  for (i = 0360; i <= 0377; i++)
+    decode_bits[i] = 0;
+}
+
+/* Without a mapping, the caller holds the lock on the file. */
 static inline int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c;
+
+  if (s->decompress != NULL)
+    {
+      c = stream_getc (s);
+      return c == EOF ? 0 : c;
+    }
+  if (s->map != NULL)
+    {
+      if (s->map_offset < s->map_size)
+        return s->map[s->map_offset++];
+      s->map_eof = 1;
+      return 0;
+    }
+  if (s->peek_size != 0)
+    c = stream_getc (s);
+  else
+    c = getc_unlocked (s->file);
   return c == EOF ? 0 : c;
 }
 
-static inline word_t
-insert (word_t word, unsigned char byte, int *bits)
+/* Decompressing, the file belongs to the decoding thread. */
+static void
+lock (struct word_stream *s)
+{
+  if (s->map == NULL && s->decompress == NULL)
+    flockfile (s->file);
+}
+
+static void
+unlock (struct word_stream *s)
 {
-  *bits += 7;
-  return (word << 7) | byte;
+  if (s->map == NULL && s->decompress == NULL)
+    funlockfile (s->file);
+}
+
+static void *
+new_its_state (void)
+{
+  struct its_state *state = new_word_state (sizeof *state);
+  state->output = -1;
+  return state;
 }
 
 static word_t
-get_its_word (FILE *f)
+decode_word (struct word_stream *s)
 {
+  struct its_state *state = s->state;
   unsigned char byte;
   word_t word;
   int bits;
 
-  if (feof (f))
+  if (stream_eof (s))
     return -1;
 
   word = 0;
   bits = 0;
 
-  if (there_is_some_leftover)
+  if (state->there_is_some_leftover)
     {
-      word = leftover;
+      word = state->leftover;
       bits = 7;
-      there_is_some_leftover = 0;
+      state->there_is_some_leftover = 0;
     }
 
   while (bits < 36)
     {
-      byte = get_byte (f);
-      if (feof (f))
+      byte = get_byte (s);
+      if (stream_eof (s))
 	{
 	  if (bits == 0)
 	    return -1;
 	}
 
-      if (byte <= 011 ||
-	  (byte >= 013 && byte <= 014) ||
-	  (byte >= 016 && byte <= 0176))
-	{
-	  word = insert (word, byte, &bits);
-	}
-      else if (byte == 012)
-	{
-	  word = insert (word, 015, &bits);
-	  word = insert (word, 012, &bits);
-	}
-      else if (byte == 015)
-	{
-	  word = insert (word, 012, &bits);
-	}
-      else if (byte == 0177)
-	{
-	  word = insert (word, 0177, &bits);
-	  word = insert (word,    7, &bits);
-	}
-      else if ((byte >= 0200 && byte <= 0206) ||
-	       (byte >= 0210 && byte <= 0211) ||
-	       (byte >= 0213 && byte <= 0214) ||
-	       (byte >= 0216 && byte <= 0355))
-	{
-	  word = insert (word, 0177,        &bits);
-	  word = insert (word, byte - 0200, &bits);
-	}
-      else if (byte == 0207)
-	{
-	  word = insert (word, 0177, &bits);
-	  word = insert (word, 0177, &bits);
-	}
-      else if (byte == 0212)
-	{
-	  word = insert (word, 0177, &bits);
-	  word = insert (word,  015, &bits);
-	}
-      else if (byte == 0215)
-	{
-	  word = insert (word, 0177, &bits);
-	  word = insert (word,  012, &bits);
-	}
-      else if (byte == 0356)
-	{
-	  word = insert (word, 015, &bits);
-	}
-      else if (byte == 0357)
-	{
-	  word = insert (word, 0177, &bits);
-	}
-      else if (byte >= 0360)
+      if (decode_bits[byte] == 0)
 	{
 	  if (bits != 0)
 	    {
-	      fprintf (stderr, "[error in 36-bit file format]\n");
-	      exit (1);
+	      state->format_error = 1;
+	      return -1;
 	    }
 	  word = byte & 017;
-	  word = (word << 8) | get_byte (f);
-	  word = (word << 8) | get_byte (f);
-	  word = (word << 8) | get_byte (f);
-	  word = (word << 8) | get_byte (f);
-	  bits = 36;
+	  word = (word << 8) | get_byte (s);
+	  word = (word << 8) | get_byte (s);
+	  word = (word << 8) | get_byte (s);
+	  word = (word << 8) | get_byte (s);
+	  break;
 	}
 
+      word = (word << decode_bits[byte]) | decode_chars[byte];
+      bits += decode_bits[byte];
+
       if (bits == 35)
 	{
 	  word <<= 1;
@@ -141,8 +174,8 @@ get_its_word (FILE *f)
 	}
       else if (bits == 42)
 	{
-	  leftover = word & 0177;
-	  there_is_some_leftover = 1;
+	  state->leftover = word & 0177;
+	  state->there_is_some_leftover = 1;
 	  word >>= 7;
 	  word <<= 1;
 	}
@@ -150,6 +183,7 @@ get_its_word (FILE *f)
 
   if (word > WORDMASK)
     {
+      unlock (s);
       fprintf (stderr, "[error in 36-bit file format (word too large)]\n");
       exit (1);
     }
@@ -158,104 +192,206 @@ get_its_word (FILE *f)
 }
 
 static void
-rewind_its_word (FILE *f)
+check_format_error (struct its_state *state)
+{
+  if (state->format_error)
+    {
+      fprintf (stderr, "[error in 36-bit file format]\n");
+      exit (1);
+    }
+}
+
+static word_t
+get_its_word (struct word_stream *s)
+{
+  word_t word;
+
+  lock (s);
+  word = decode_word (s);
+  unlock (s);
+  check_format_error (s->state);
+  return word;
+}
+
+/* Decode a block of words while holding the lock on the file once.  A
+   format error is reported on the next call, so the words before it
+   are still returned. */
+static size_t
+get_its_words (struct word_stream *s, word_t *buffer, size_t n)
+{
+  struct its_state *state = s->state;
+  size_t i;
+  word_t word;
+
+  check_format_error (state);
+  lock (s);
+  for (i = 0; i < n; i++)
+    {
+      word = decode_word (s);
+      if (word == -1)
+	break;
+      buffer[i] = word;
+    }
+  unlock (s);
+  if (i == 0)
+    check_format_error (state);
+  return i;
+}
+
+static void
+rewind_its_word (struct word_stream *s)
+{
+  struct its_state *state = s->state;
+  state->there_is_some_leftover = 0;
+  state->format_error = 0;
+  state->output = -1;
+  stream_rewind (s);
+}
+
+/* A pending leftover character is kept in the checkpoint. */
+static int
+save_its_state (struct word_stream *s, struct word_checkpoint *c)
 {
-  there_is_some_leftover = 0;
-  output = -1;
-  rewind (f);
+  struct its_state *state = s->state;
+  if (state->format_error)
+    return 0;
+  if (state->there_is_some_leftover)
+    c->data = 0200 | state->leftover;
+  return 1;
 }
 
 static void
-fputc2 (int c1, int c2, FILE *f)
+restore_its_state (struct word_stream *s, const struct word_checkpoint *c)
 {
-  fputc (c1, f);
-  fputc (c2, f);
+  struct its_state *state = s->state;
+  state->there_is_some_leftover = (c->data & 0200) != 0;
+  state->leftover = c->data & 0177;
 }
 
-static int previous_octet = -1;
+/* Each character written depends on whether the previous one was a
+   CR or a rubout, which are held back to see if they can be combined
+   with the next.  The table gives, for each of those three cases and
+   each character, the octets to write and the next case. */
+#define PLAIN  0
+#define CR     1
+#define RUBOUT 2
+
+struct its_encoding {
+  unsigned char n, octets[2], next;
+};
+
+static struct its_encoding encode[3][128];
 
 static void
-end_word (FILE *f)
+encode_entry (int previous, int c, int o1, int o2, int next)
 {
-  if (previous_octet == 015)
-    fputc (0356, f);
-  else if (previous_octet == 0177)
-    fputc (0357, f);
-  previous_octet = -1;
+  struct its_encoding *e = &encode[previous][c];
+  e->n = (o1 >= 0) + (o2 >= 0);
+  e->octets[0] = o1;
+  e->octets[1] = o2;
+  e->next = next;
 }
 
 static void
-binary_word (FILE *f, word_t word)
+init_encode_table (void)
 {
-  end_word (f);
+  int c;
 
-  fputc (((word >> 32) &  017) + 0360, f);
-  fputc (((word >> 24) & 0377), f);
-  fputc (((word >> 16) & 0377), f);
-  fputc (((word >>  8) & 0377), f);
-  fputc (( word        & 0377), f);
+  for (c = 0; c < 0200; c++)
+    {
+      encode_entry (PLAIN, c, c, -1, PLAIN);
+      encode_entry (CR, c, 0356, c, PLAIN);
+      if (c < 0156)
+	encode_entry (RUBOUT, c, c + 0200, -1, PLAIN);
+      else
+	encode_entry (RUBOUT, c, 0357, c, PLAIN);
+    }
+
+  encode_entry (PLAIN, 012, 015, -1, PLAIN);
+  encode_entry (PLAIN, 015, -1, -1, CR);
+  encode_entry (PLAIN, 0177, -1, -1, RUBOUT);
+
+  encode_entry (CR, 012, 012, -1, PLAIN);
+  encode_entry (CR, 015, 0356, 0356, PLAIN);
+  encode_entry (CR, 0177, 0356, 0357, PLAIN);
+
+  encode_entry (RUBOUT, 0007, 0177, -1, PLAIN);
+  encode_entry (RUBOUT, 0012, 0215, -1, PLAIN);
+  encode_entry (RUBOUT, 0015, 0212, -1, PLAIN);
+  encode_entry (RUBOUT, 0177, 0207, -1, PLAIN);
 }
 
+/* Build the tables before main is called, so there is no race
+   between threads. */
+__attribute__ ((constructor))
 static void
-ascii_word (FILE *f, word_t word, int n)
+init_tables (void)
 {
-  char c, octets[5];
-  int i;
+  init_decode_table ();
+  init_encode_table ();
+}
 
-  octets[0] = (word >> 29) & 0177;
-  octets[1] = (word >> 22) & 0177;
-  octets[2] = (word >> 15) & 0177;
-  octets[3] = (word >>  8) & 0177;
-  octets[4] = (word >>  1) & 0177;
+/* Number of words encoded for each fwrite. */
+#define CHUNK 1024
 
-  for (i = 0; i < n; i++)
-    {
-      c = octets[i];
+/* Octets are collected and written in one go.  One word takes at most
+   eleven, and ascii_word may store one more than it uses. */
+struct its_octets {
+  unsigned char octets[12 * CHUNK];
+  int n;
+};
 
-      if (previous_octet == 015)
-	{
-	  if (c == 012)
-	    fputc (012, f);
-	  else if (c == 015)
-	    fputc2 (0356, 0356, f);
-	  else if (c == 0177)
-	    fputc2 (0356, 0357, f);
-	  else
-	    fputc2 (0356, c, f);
-	  previous_octet = -1;
-	}
-      else if (previous_octet == 0177)
-	{
-	  switch (c)
-	    {
-	    case 0007: fputc (0177, f); break;
-	    case 0012: fputc (0215, f); break;
-	    case 0015: fputc (0212, f); break;
-	    case 0177: fputc (0207, f); break;
-	    default:
-	      if (c < 0156)
-		fputc (c + 0200, f);
-	      else if (c == 012)
-		fputc2 (0357, 015, f);
-	      else if (c == 015)
-		fputc2 (0357, 0356, f);
-	      else if (c == 0177)
-		fputc2 (0357, 0357, f);
-	      else
-		fputc2 (0357, c, f);
-	      break;
-	    }
-	  previous_octet = -1;
-	}
-      else if (c == 015 || c == 0177)
-	previous_octet = c;
-      else if (c == 012)
-	fputc (015, f);
-      else
-	fputc (c, f);
+static void
+end_word (struct its_octets *out, struct its_state *state)
+{
+  if (state->previous == CR)
+    out->octets[out->n++] = 0356;
+  else if (state->previous == RUBOUT)
+    out->octets[out->n++] = 0357;
+  state->previous = PLAIN;
+}
+
+static void
+binary_word (struct its_octets *out, struct its_state *state, word_t word)
+{
+  unsigned char *p;
+
+  end_word (out, state);
+
+  p = out->octets + out->n;
+  p[0] = ((word >> 32) &  017) + 0360;
+  p[1] = ((word >> 24) & 0377);
+  p[2] = ((word >> 16) & 0377);
+  p[3] = ((word >>  8) & 0377);
+  p[4] = ( word        & 0377);
+  out->n += 5;
+}
+
+static void
+ascii_word (struct its_octets *out, struct its_state *state,
+	    word_t word, int n)
+{
+  const struct its_encoding *e;
+  int i, shift;
+
+  for (i = 0, shift = 29; i < n; i++, shift -= 7)
+    {
+      e = &encode[state->previous][(word >> shift) & 0177];
+      out->octets[out->n] = e->octets[0];
+      out->octets[out->n + 1] = e->octets[1];
+      out->n += e->n;
+      state->previous = e->next;
     }
 }
 
+static void
+write_octets (FILE *f, struct its_octets *out)
+{
+  if (out->n > 0)
+    fwrite (out->octets, 1, out->n, f);
+  out->n = 0;
+}
+
 static int
 characters (word_t word)
 {
@@ -272,29 +408,91 @@ characters (word_t word)
 }
 
 static void
-flush_its_word (FILE *f)
+flush_its_word (struct word_stream *s)
 {
-  end_word (f);
-  if (output == -1)
-    return;
-  if (output & 1)
-    binary_word (f, output);
-  else
-    ascii_word (f, output, characters (output));
-  output = -1;
-}
+  struct its_state *state = s->state;
+  word_t output = state->output;
+  struct its_octets out;
 
-static void
-write_its_word (FILE *f, word_t word)
-{
+  out.n = 0;
+  end_word (&out, state);
   if (output != -1)
     {
       if (output & 1)
-	binary_word (f, output);
+	binary_word (&out, state, output);
       else
-	ascii_word (f, output, 5);
+	ascii_word (&out, state, output, characters (output));
+      state->output = -1;
     }
-  output = word;
+  write_octets (s->file, &out);
+}
+
+/* Each word is held back until the next, since the last one is
+   written differently. */
+static void
+write_its_words (struct word_stream *s, const word_t *buffer, size_t n)
+{
+  struct its_state *state = s->state;
+  struct its_octets out;
+  word_t output;
+  size_t i;
+
+  out.n = 0;
+  for (i = 0; i < n; i++)
+    {
+      output = state->output;
+      if (output != -1)
+	{
+	  if (output & 1)
+	    binary_word (&out, state, output);
+	  else
+	    ascii_word (&out, state, output, 5);
+	  if (out.n > (int)sizeof out.octets - 12)
+	    write_octets (s->file, &out);
+	}
+      state->output = buffer[i];
+    }
+  write_octets (s->file, &out);
+}
+
+static void
+write_its_word (struct word_stream *s, word_t word)
+{
+  write_its_words (s, &word, 1);
+}
+
+/* Decode as far as possible without a framing error.  Octets that
+   escape a rubout are valid, but rare in real files. */
+static int
+score_its (const unsigned char *octets, size_t n, int whole)
+{
+  size_t i = 0, good = 0;
+  int bits = 0;
+
+  (void)whole;
+  while (i < n)
+    {
+      unsigned char byte = octets[i];
+      if (decode_bits[byte] == 0)
+        {
+          if (bits != 0)
+            break;
+          good += n - i < 5 ? n - i : 5;
+          i += 5;
+          continue;
+        }
+
+      if (byte < 0200 || byte >= 0356)
+        good++;
+      i++;
+      bits += decode_bits[byte];
+      if (bits == 35)
+        bits = 0;
+      else if (bits == 42)
+        bits = 7;
+    }
+
+  return word_score (good, n, 0.0);
 }
 
 struct word_format its_word_format = {
@@ -303,5 +501,12 @@ struct word_format its_word_format = {
   rewind_its_word,
   NULL,
   write_its_word,
-  flush_its_word
+  flush_its_word,
+  get_its_words,
+  write_its_words,
+  new_its_state,
+  NULL,
+  save_its_state,
+  restore_its_state,
+  score_its
 };
@@ -18,13 +18,80 @@
 
 typedef long long word_t;
 
+struct word_stream;
+struct word_checkpoint;
+struct decompress;
+
 struct word_format {
   const char *name;
-  word_t (*get_word) (FILE *);
-  void (*rewind_word) (FILE *);		/* NULL means just rewind (f) */
-  void (*seek_word) (FILE *, int);	/* NULL means rewind and go forward. */
-  void (*write_word) (FILE *, word_t);
-  void (*flush_word) (FILE *);		/* NULL means do nothing */
+  word_t (*get_word) (struct word_stream *);
+  void (*rewind_word) (struct word_stream *);	/* NULL means just rewind (f) */
+  void (*seek_word) (struct word_stream *, int); /* NULL means rewind and go forward. */
+  void (*write_word) (struct word_stream *, word_t);
+  void (*flush_word) (struct word_stream *);	/* NULL means do nothing */
+  size_t (*get_words) (struct word_stream *, word_t *, size_t); /* NULL means use get_word */
+  void (*write_words) (struct word_stream *, const word_t *, size_t); /* NULL means use write_word */
+  void *(*new_state) (void);		/* NULL means no state */
+  void (*free_state) (void *);		/* NULL means free (state) */
+  int (*save_state) (struct word_stream *, struct word_checkpoint *); /* NULL means no checkpoints */
+  void (*restore_state) (struct word_stream *, const struct word_checkpoint *); /* NULL means nothing to restore */
+  int (*score) (const unsigned char *, size_t, int); /* NULL means never guessed */
+};
+
+/* Where to resume decoding a format without a seek_word of its own.
+   The offset is set to the file position before save_state is called,
+   which may change it, e.g. to the start of a record. */
+struct word_checkpoint {
+  long position;			/* Words from the start. */
+  long offset;				/* Octets from the start. */
+  word_t data;				/* Decoder state. */
+};
+
+/* A file read or written in some word format, along with the state
+   the format needs.  Each stream is independent of all others, so
+   several can be used at the same time, or in different threads. */
+struct word_stream {
+  FILE *file;
+  struct word_format *format;
+  /* The format asked for, which is auto until a guess replaces it. */
+  struct word_format *requested;
+  void *state;
+  word_t checksum;
+  /* Number of words read, and checkpoints for seek_word. */
+  long position;
+  struct word_checkpoint *checkpoints;
+  size_t checkpoints_used, checkpoints_size;
+  /* Input file mapped into memory, or NULL to use stdio. */
+  const unsigned char *map;
+  size_t map_size, map_offset;
+  int map_eof;
+  /* Octets to read before the file, and the file offset of the first,
+     or -1 if unknown. */
+  unsigned char *peek;
+  size_t peek_size, peek_offset;
+  long peek_base;
+  /* Decoder of compressed input, or NULL. */
+  struct decompress *decompress;
+  /* Nonzero once the input has been checked for compression, and the
+     format guessed if need be. */
+  int started;
+  /* Nonzero after the end of the file, until rewound.  The position
+     then counts from wherever the FILE is, so seeking must start over
+     from the beginning. */
+  int ended;
+};
+
+/* Where each record of a tape image starts, and its length or tape
+   mark, gap, or error code. */
+struct tape_index_record {
+  long offset;
+  unsigned reclen;
+};
+
+struct tape_index {
+  struct tape_index_record *record;
+  size_t records;
+  int damaged;	/* The records end before the image does. */
 };
 
 enum {
@@ -35,6 +102,7 @@ enum {
 
 extern struct word_format *input_word_format;
 extern struct word_format *output_word_format;
+extern struct word_format auto_word_format;
 extern struct word_format aa_word_format;
 extern struct word_format alto_word_format;
 extern struct word_format bin_word_format;
@@ -49,22 +117,77 @@ extern struct word_format sail_word_format;
 extern struct word_format tape_word_format;
 extern struct word_format tape7_word_format;
 
+extern void	*new_word_state (size_t);
+extern void	init_word_stream (struct word_stream *, FILE *,
+				  struct word_format *);
+extern void	free_word_stream (struct word_stream *);
+extern struct word_stream *input_word_stream (FILE *f);
+extern struct word_stream *output_word_stream (FILE *f);
+extern void	start_word_input (struct word_stream *);
+extern word_t	stream_get_word (struct word_stream *);
+extern size_t	stream_get_words (struct word_stream *, word_t *, size_t);
+extern size_t	stream_get_all_words (struct word_stream *, word_t **,
+				      size_t *);
+extern long	stream_words_left (struct word_stream *);
+extern word_t	stream_get_checksummed_word (struct word_stream *);
+extern void	stream_rewind_word (struct word_stream *);
+extern void	stream_seek_word (struct word_stream *, int position);
+extern void	stream_write_word (struct word_stream *, word_t);
+extern void	stream_write_words (struct word_stream *, const word_t *,
+				    size_t);
+extern void	stream_flush_word (struct word_stream *);
+extern int	map_word_stream (struct word_stream *);
+extern void	unmap_word_stream (struct word_stream *);
+extern const unsigned char *stream_peek (struct word_stream *, size_t,
+					  size_t *);
+extern void	drop_peek (struct word_stream *);
+extern int	stream_getc (struct word_stream *);
+extern int	stream_eof (struct word_stream *);
+extern const unsigned char *stream_octets (struct word_stream *, void *,
+					   size_t, size_t *);
+extern size_t	stream_read (struct word_stream *, void *, size_t);
+extern char	*stream_gets (struct word_stream *, char *, int);
+extern void	stream_rewind (struct word_stream *);
+extern void	stream_seek (struct word_stream *, long offset);
+extern long	stream_tell (struct word_stream *);
+extern int	start_decompress (struct word_stream *);
+extern void	end_decompress (struct word_stream *);
+extern int	next_decompressed (struct word_stream *);
+extern int	append_decompressed (struct word_stream *);
+extern int	restart_decompress (struct word_stream *);
+
 extern void     usage_word_format (void);
 extern int      parse_input_word_format (const char *);
 extern int      parse_output_word_format (const char *);
+extern struct word_format *guess_word_format (const unsigned char *, size_t,
+					       int whole, int *confidence);
+extern void	guess_word_stream (struct word_stream *);
+extern int	word_score (size_t good, size_t total, double chance);
+extern word_t	stream_peek_word (struct word_stream *);
 extern word_t	get_word (FILE *f);
+extern word_t	peek_word (FILE *f);
+extern size_t	get_words (FILE *f, word_t *buffer, size_t n);
+extern size_t	get_all_words (FILE *f, word_t **buffer, size_t *size);
+extern long	words_left (FILE *f);
 extern word_t	get_checksummed_word (FILE *f);
 extern void	reset_checksum (word_t);
 extern void	check_checksum (word_t);
 extern void	rewind_word (FILE *f);
+extern int	map_word_file (FILE *f);
+extern void	unmap_word_file (FILE *f);
 extern void	seek_word (FILE *f, int position);
-extern void	by_five_octets (FILE *f, int position);
-extern void	by_eight_octets (FILE *f, int position);
+extern void	by_five_octets (struct word_stream *, int position);
+extern void	by_eight_octets (struct word_stream *, int position);
+extern int	save_offset (struct word_stream *, struct word_checkpoint *);
 extern void	write_word (FILE *, word_t);
+extern void	write_words (FILE *, const word_t *, size_t);
 extern void	flush_word (FILE *);
 extern void     (*tape_hook) (int code);
+extern int	write_tape_index;
 extern int      get_7track_record (FILE *f, word_t **buffer);
 extern int      get_9track_record (FILE *f, word_t **buffer);
+extern int      read_7track_record (FILE *f, word_t **buffer, int *size);
+extern int      read_9track_record (FILE *f, word_t **buffer, int *size);
 extern void     write_7track_record (FILE *f, word_t *buffer, int);
 extern void     write_9track_record (FILE *f, word_t *buffer, int);
 extern void     write_tape_mark (FILE *f);
@@ -72,7 +195,22 @@ extern void     write_tape_eof (FILE *f);
 extern void     write_tape_eot (FILE *f);
 extern void     write_tape_gap (FILE *f, unsigned code);
 extern void     write_tape_error (FILE *f, unsigned code);
+extern struct tape_index *index_tape (FILE *f);
+extern struct tape_index *load_tape_index (const char *name, FILE *f);
+extern void	free_tape_index (struct tape_index *);
+extern int	seek_tape_file (FILE *f, const struct tape_index *, int file);
+extern int	peek_tape_record (FILE *f, const struct tape_index *,
+				  word_t *words, int n);
+extern int	skip_tape_record (FILE *f, const struct tape_index *);
 extern word_t	get_core_word (FILE *f);
+extern void	unpack_core_words (const unsigned char *, word_t *, size_t);
+extern void	pack_core_words (const word_t *, unsigned char *, size_t);
+extern void	unpack_bin_words (const unsigned char *, word_t *, size_t);
+extern void	pack_bin_words (const word_t *, unsigned char *, size_t);
+extern int	unpack_data8_words (const unsigned char *, word_t *, size_t);
+extern void	pack_data8_words (const word_t *, unsigned char *, size_t);
+extern const char *pack_kernels (void);
+extern void	select_pack_kernels (int simd);
 extern void	write_core_word (FILE *f, word_t word);
 
 #endif /* LIBWORD_H */
@@ -21,9 +21,9 @@
 #include "libword.h"
 
 static word_t
-get_oct_word (FILE *f)
+get_oct_word (struct word_stream *s)
 {
-  static char line[100];
+  char line[100];
   word_t word;
   char *p;
   int i;
@@ -31,7 +31,7 @@ get_oct_word (FILE *f)
   for (;;)
     {
     next:
-      p = fgets (line, sizeof line, f);
+      p = stream_gets (s, line, sizeof line);
       if (p == NULL)
         return -1;
 
@@ -54,10 +54,59 @@ get_oct_word (FILE *f)
     }
 }
 
+/* Number of lines formatted for each fwrite. */
+#define CHUNK 1024
+
+static void
+write_oct_words (struct word_stream *s, const word_t *buffer, size_t n)
+{
+  char lines[13 * CHUNK], *p;
+  size_t i, m;
+  word_t word;
+  int j;
+
+  for (; n > 0; n -= m, buffer += m)
+    {
+      m = n > CHUNK ? CHUNK : n;
+      for (i = 0, p = lines; i < m; i++, p += 13)
+        {
+          word = buffer[i];
+          for (j = 11; j >= 0; j--, word >>= 3)
+            p[j] = '0' + (word & 7);
+          p[12] = '\n';
+        }
+      fwrite (lines, 13, m, s->file);
+    }
+}
+
 static void
-write_oct_word (FILE *f, word_t word)
+write_oct_word (struct word_stream *s, word_t word)
+{
+  write_oct_words (s, &word, 1);
+}
+
+/* Count the octets in complete lines which hold a word. */
+static int
+score_oct (const unsigned char *octets, size_t n, int whole)
 {
-  fprintf (f, "%012llo\n", word & 0777777777777LL);
+  const unsigned char *p, *end, *line = octets;
+  size_t good = 0, total = 0;
+  int i;
+
+  (void)whole;
+  while ((end = memchr (line, '\n', octets + n - line)) != NULL)
+    {
+      end++;
+      total += end - line;
+      for (p = line; *p == ' ' || *p == '\t'; p++)
+        ;
+      for (i = 0; i < 12 && p < end && *p >= '0' && *p <= '7'; i++)
+        p++;
+      if (i == 12 && !(*p >= '0' && *p <= '7'))
+        good += end - line;
+      line = end;
+    }
+  return word_score (good, total, 0.0);
 }
 
 struct word_format oct_word_format = {
@@ -66,5 +115,12 @@ struct word_format oct_word_format = {
   NULL,
   NULL,
   write_oct_word,
-  NULL
+  NULL,
+  NULL,
+  write_oct_words,
+  NULL,
+  NULL,
+  save_offset,
+  NULL,
+  score_oct
 };
@@ -0,0 +1,478 @@
+/* Copyright (C) 2026 Lars Brinkhoff <lars@nocrew.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* Convert whole buffers between octets and words for the core, bin,
+   and data8 formats.  There are scalar versions which work anywhere,
+   and SSE4 and AVX2 versions for x86 which are selected at run time. */
+
+#include <stdio.h>
+
+#include "libword.h"
+
+#if (defined (__x86_64__) || defined (__i386__)) && defined (__GNUC__)
+#define X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#define MASK36 0777777777777LL
+#define MASK40 0xFFFFFFFFFFLL
+#define DATA8_GARBAGE 0xFFFFFFF000000000LL
+
+static inline word_t
+core_word (const unsigned char *p)
+{
+  return ((word_t)p[0] << 28) |
+         ((word_t)p[1] << 20) |
+         ((word_t)p[2] << 12) |
+         ((word_t)p[3] <<  4) |
+          (word_t)p[4];
+}
+
+static inline void
+core_octets (unsigned char *p, word_t word)
+{
+  p[0] = (word >> 28) & 0xFF;
+  p[1] = (word >> 20) & 0xFF;
+  p[2] = (word >> 12) & 0xFF;
+  p[3] = (word >>  4) & 0xFF;
+  p[4] =  word        & 0x0F;
+}
+
+static inline void
+bin_words (word_t *buffer, const unsigned char *p)
+{
+  buffer[0] = (word_t)p[0] << 28 |
+              (word_t)p[1] << 20 |
+              (word_t)p[2] << 12 |
+              (word_t)p[3] <<  4 |
+              (word_t)p[4] >>  4;
+  buffer[1] = (word_t)(p[4] & 0x0f) << 32 |
+              (word_t)p[5] << 24 |
+              (word_t)p[6] << 16 |
+              (word_t)p[7] <<  8 |
+              (word_t)p[8];
+}
+
+static inline void
+bin_octets (unsigned char *p, const word_t *buffer)
+{
+  word_t a = buffer[0], b = buffer[1];
+  p[0] = (a >> 28) & 0xff;
+  p[1] = (a >> 20) & 0xff;
+  p[2] = (a >> 12) & 0xff;
+  p[3] = (a >>  4) & 0xff;
+  p[4] = ((a << 4) & 0xf0) | ((b >> 32) & 0x0f);
+  p[5] = (b >> 24) & 0xff;
+  p[6] = (b >> 16) & 0xff;
+  p[7] = (b >>  8) & 0xff;
+  p[8] =  b        & 0xff;
+}
+
+static inline word_t
+data8_word (const unsigned char *p)
+{
+  return (word_t)p[0]       | (word_t)p[1] <<  8 |
+         (word_t)p[2] << 16 | (word_t)p[3] << 24 |
+         (word_t)p[4] << 32 | (word_t)p[5] << 40 |
+         (word_t)p[6] << 48 | (word_t)p[7] << 56;
+}
+
+static inline void
+data8_octets (unsigned char *p, word_t word)
+{
+  p[0] = (word >>  0) & 0xff;
+  p[1] = (word >>  8) & 0xff;
+  p[2] = (word >> 16) & 0xff;
+  p[3] = (word >> 24) & 0xff;
+  p[4] = (word >> 32) & 0xff;
+  p[5] = 0;
+  p[6] = 0;
+  p[7] = 0;
+}
+
+/* Scalar versions.  The core unpacker goes from the end, so the
+   octets may be stored at the start of the word buffer. */
+
+static void
+unpack_core_scalar (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  word_t word;
+
+  while (n-- > 0)
+    {
+      word = core_word (octets + 5 * n);
+      buffer[n] = word;
+    }
+}
+
+static void
+pack_core_scalar (const word_t *buffer, unsigned char *octets, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++, octets += 5)
+    core_octets (octets, buffer[i]);
+}
+
+static void
+unpack_bin_scalar (const unsigned char *octets, word_t *buffer, size_t pairs)
+{
+  size_t i;
+  for (i = 0; i < pairs; i++, octets += 9, buffer += 2)
+    bin_words (buffer, octets);
+}
+
+static void
+pack_bin_scalar (const word_t *buffer, unsigned char *octets, size_t pairs)
+{
+  size_t i;
+  for (i = 0; i < pairs; i++, octets += 9, buffer += 2)
+    bin_octets (octets, buffer);
+}
+
+static size_t
+unpack_data8_scalar (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  size_t i;
+  word_t garbage = 0;
+  for (i = 0; i < n; i++, octets += 8)
+    garbage |= buffer[i] = data8_word (octets);
+  return (garbage & DATA8_GARBAGE) != 0;
+}
+
+static void
+pack_data8_scalar (const word_t *buffer, unsigned char *octets, size_t n)
+{
+  size_t i;
+  for (i = 0; i < n; i++, octets += 8)
+    data8_octets (octets, buffer[i]);
+}
+
+#ifdef X86_SIMD
+
+/* Shuffle two core words in octets 0-9 to 64-bit lanes holding octets
+   0-3 in big endian order, and octet 4. */
+#define CORE_HIGH 3, 2, 1, 0, -1, -1, -1, -1, 8, 7, 6, 5, -1, -1, -1, -1
+#define CORE_LOW  4, -1, -1, -1, -1, -1, -1, -1, 9, -1, -1, -1, -1, -1, -1, -1
+/* And back again. */
+#define CORE_PACK 3, 2, 1, 0, 4, 11, 10, 9, 8, 12, -1, -1, -1, -1, -1, -1
+
+/* A bin word pair in octets 0-8 to two lanes with octets 0-4 and 4-8
+   in big endian order. */
+#define BIN_UNPACK 4, 3, 2, 1, 0, -1, -1, -1, 8, 7, 6, 5, 4, -1, -1, -1
+
+static inline __m128i
+mask128 (char a0, char a1, char a2, char a3, char a4, char a5, char a6,
+	 char a7, char a8, char a9, char a10, char a11, char a12,
+	 char a13, char a14, char a15)
+{
+  return _mm_setr_epi8 (a0, a1, a2, a3, a4, a5, a6, a7,
+			a8, a9, a10, a11, a12, a13, a14, a15);
+}
+
+__attribute__ ((target ("sse4.1")))
+static void
+unpack_core_sse4 (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  __m128i high = mask128 (CORE_HIGH), low = mask128 (CORE_LOW);
+  __m128i x, y;
+  size_t m, i;
+
+  /* Each load reads 16 octets, which is 6 more than two words. */
+  m = n < 2 ? 0 : ((n - 2) / 2) * 2;
+  unpack_core_scalar (octets + 5 * m, buffer + m, n - m);
+
+  for (i = m; i > 0; )
+    {
+      i -= 2;
+      x = _mm_loadu_si128 ((const __m128i *)(octets + 5 * i));
+      y = _mm_or_si128 (_mm_slli_epi64 (_mm_shuffle_epi8 (x, high), 4),
+			_mm_shuffle_epi8 (x, low));
+      _mm_storeu_si128 ((__m128i *)(buffer + i), y);
+    }
+}
+
+__attribute__ ((target ("avx2")))
+static void
+unpack_core_avx2 (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  __m256i high = _mm256_broadcastsi128_si256 (mask128 (CORE_HIGH));
+  __m256i low = _mm256_broadcastsi128_si256 (mask128 (CORE_LOW));
+  __m256i x, y;
+  size_t m, i;
+
+  /* Four words from two loads, the second reading six octets past
+     the end of the fourth word. */
+  m = n < 2 ? 0 : ((n - 2) / 4) * 4;
+  unpack_core_scalar (octets + 5 * m, buffer + m, n - m);
+
+  for (i = m; i > 0; )
+    {
+      i -= 4;
+      x = _mm256_inserti128_si256
+	(_mm256_castsi128_si256
+	 (_mm_loadu_si128 ((const __m128i *)(octets + 5 * i))),
+	 _mm_loadu_si128 ((const __m128i *)(octets + 5 * i + 10)), 1);
+      y = _mm256_or_si256 (_mm256_slli_epi64 (_mm256_shuffle_epi8 (x, high), 4),
+			   _mm256_shuffle_epi8 (x, low));
+      _mm256_storeu_si256 ((__m256i *)(buffer + i), y);
+    }
+}
+
+__attribute__ ((target ("sse4.1")))
+static void
+pack_core_sse4 (const word_t *buffer, unsigned char *octets, size_t n)
+{
+  __m128i pack = mask128 (CORE_PACK);
+  __m128i mask32 = _mm_set1_epi64x (0xFFFFFFFFLL);
+  __m128i mask4 = _mm_set1_epi64x (0x0FLL);
+  __m128i x, y;
+  size_t i;
+
+  /* Each store writes 16 octets, six into the next two words which
+     are overwritten by the next iteration or the scalar tail. */
+  for (i = 0; i + 4 <= n; i += 2)
+    {
+      /* Lanes get the upper 32 bits in octets 0-3 and the lower four
+	 bits in octet 4. */
+      x = _mm_loadu_si128 ((const __m128i *)(buffer + i));
+      y = _mm_or_si128 (_mm_and_si128 (_mm_srli_epi64 (x, 4), mask32),
+			_mm_slli_epi64 (_mm_and_si128 (x, mask4), 32));
+      _mm_storeu_si128 ((__m128i *)(octets + 5 * i),
+			_mm_shuffle_epi8 (y, pack));
+    }
+
+  pack_core_scalar (buffer + i, octets + 5 * i, n - i);
+}
+
+__attribute__ ((target ("sse4.1")))
+static void
+unpack_bin_sse4 (const unsigned char *octets, word_t *buffer, size_t pairs)
+{
+  __m128i shuffle = mask128 (BIN_UNPACK);
+  __m128i mask36 = _mm_set1_epi64x (MASK36);
+  __m128i x;
+  size_t i;
+
+  /* Each load reads 16 octets, 7 more than a pair. */
+  for (i = 0; i + 1 < pairs; i++, octets += 9, buffer += 2)
+    {
+      x = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)octets),
+			    shuffle);
+      /* Shift the first word down four bits, keep the second. */
+      x = _mm_blend_epi16 (_mm_srli_epi64 (x, 4), x, 0xF0);
+      _mm_storeu_si128 ((__m128i *)buffer, _mm_and_si128 (x, mask36));
+    }
+
+  unpack_bin_scalar (octets, buffer, pairs - i);
+}
+
+__attribute__ ((target ("avx2")))
+static void
+unpack_bin_avx2 (const unsigned char *octets, word_t *buffer, size_t pairs)
+{
+  __m256i shuffle = _mm256_broadcastsi128_si256 (mask128 (BIN_UNPACK));
+  __m256i shift = _mm256_setr_epi64x (4, 0, 4, 0);
+  __m256i mask36 = _mm256_set1_epi64x (MASK36);
+  __m256i x;
+  size_t i;
+
+  /* Two pairs from two loads, the second reading 7 octets past the
+     second pair. */
+  for (i = 0; i + 2 < pairs; i += 2, octets += 18, buffer += 4)
+    {
+      x = _mm256_inserti128_si256
+	(_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *)octets)),
+	 _mm_loadu_si128 ((const __m128i *)(octets + 9)), 1);
+      x = _mm256_srlv_epi64 (_mm256_shuffle_epi8 (x, shuffle), shift);
+      _mm256_storeu_si256 ((__m256i *)buffer, _mm256_and_si256 (x, mask36));
+    }
+
+  unpack_bin_scalar (octets, buffer, pairs - i);
+}
+
+__attribute__ ((target ("sse4.1")))
+static size_t
+unpack_data8_sse4 (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  __m128i garbage = _mm_setzero_si128 ();
+  __m128i x;
+  size_t i;
+
+  for (i = 0; i + 2 <= n; i += 2)
+    {
+      x = _mm_loadu_si128 ((const __m128i *)(octets + 8 * i));
+      _mm_storeu_si128 ((__m128i *)(buffer + i), x);
+      garbage = _mm_or_si128 (garbage, x);
+    }
+
+  return unpack_data8_scalar (octets + 8 * i, buffer + i, n - i)
+    || !_mm_testz_si128 (garbage, _mm_set1_epi64x (DATA8_GARBAGE));
+}
+
+__attribute__ ((target ("avx2")))
+static size_t
+unpack_data8_avx2 (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  __m256i garbage = _mm256_setzero_si256 ();
+  __m256i x;
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      x = _mm256_loadu_si256 ((const __m256i *)(octets + 8 * i));
+      _mm256_storeu_si256 ((__m256i *)(buffer + i), x);
+      garbage = _mm256_or_si256 (garbage, x);
+    }
+
+  return unpack_data8_scalar (octets + 8 * i, buffer + i, n - i)
+    || !_mm256_testz_si256 (garbage, _mm256_set1_epi64x (DATA8_GARBAGE));
+}
+
+__attribute__ ((target ("avx2")))
+static void
+pack_data8_avx2 (const word_t *buffer, unsigned char *octets, size_t n)
+{
+  __m256i mask = _mm256_set1_epi64x (MASK40);
+  __m256i x;
+  size_t i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    {
+      x = _mm256_loadu_si256 ((const __m256i *)(buffer + i));
+      _mm256_storeu_si256 ((__m256i *)(octets + 8 * i),
+			   _mm256_and_si256 (x, mask));
+    }
+
+  pack_data8_scalar (buffer + i, octets + 8 * i, n - i);
+}
+
+#endif /* X86_SIMD */
+
+static void (*unpack_core) (const unsigned char *, word_t *, size_t)
+  = unpack_core_scalar;
+static void (*pack_core) (const word_t *, unsigned char *, size_t)
+  = pack_core_scalar;
+static void (*unpack_bin) (const unsigned char *, word_t *, size_t)
+  = unpack_bin_scalar;
+static void (*pack_bin) (const word_t *, unsigned char *, size_t)
+  = pack_bin_scalar;
+static size_t (*unpack_data8) (const unsigned char *, word_t *, size_t)
+  = unpack_data8_scalar;
+static void (*pack_data8) (const word_t *, unsigned char *, size_t)
+  = pack_data8_scalar;
+static const char *kernels = "scalar";
+
+/* Select kernels: the best for this CPU if simd is nonzero, otherwise
+   the scalar ones. */
+void
+select_pack_kernels (int simd)
+{
+  unpack_core = unpack_core_scalar;
+  pack_core = pack_core_scalar;
+  unpack_bin = unpack_bin_scalar;
+  pack_bin = pack_bin_scalar;
+  unpack_data8 = unpack_data8_scalar;
+  pack_data8 = pack_data8_scalar;
+  kernels = "scalar";
+
+  if (!simd)
+    return;
+
+#ifdef X86_SIMD
+  __builtin_cpu_init ();
+
+  /* The data8 kernels just copy words, which only works on a little
+     endian host.  That's a given on x86.  There is no SIMD bin packer;
+     it measured slower than the scalar one. */
+  if (__builtin_cpu_supports ("sse4.1"))
+    {
+      unpack_core = unpack_core_sse4;
+      pack_core = pack_core_sse4;
+      unpack_bin = unpack_bin_sse4;
+      unpack_data8 = unpack_data8_sse4;
+      kernels = "sse4";
+    }
+
+  if (__builtin_cpu_supports ("avx2"))
+    {
+      unpack_core = unpack_core_avx2;
+      unpack_bin = unpack_bin_avx2;
+      unpack_data8 = unpack_data8_avx2;
+      pack_data8 = pack_data8_avx2;
+      kernels = "avx2";
+    }
+#endif
+}
+
+#ifdef X86_SIMD
+/* Select before main is called, so there is no race between threads. */
+__attribute__ ((constructor))
+static void
+init_pack_kernels (void)
+{
+  select_pack_kernels (1);
+}
+#endif
+
+/* Name of the kernels in use. */
+const char *
+pack_kernels (void)
+{
+  return kernels;
+}
+
+/* Unpack n words from octets in core dump format.  The octets may be
+   stored at the start of the word buffer. */
+void
+unpack_core_words (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  unpack_core (octets, buffer, n);
+}
+
+/* Pack n words to octets in core dump format. */
+void
+pack_core_words (const word_t *buffer, unsigned char *octets, size_t n)
+{
+  pack_core (buffer, octets, n);
+}
+
+/* Unpack pairs of words from octets in bin format, nine per pair. */
+void
+unpack_bin_words (const unsigned char *octets, word_t *buffer, size_t pairs)
+{
+  unpack_bin (octets, buffer, pairs);
+}
+
+/* Pack pairs of words to octets in bin format. */
+void
+pack_bin_words (const word_t *buffer, unsigned char *octets, size_t pairs)
+{
+  pack_bin (buffer, octets, pairs);
+}
+
+/* Unpack n words from octets in data8 format.  Return nonzero if any
+   word has bits set above the low 36. */
+int
+unpack_data8_words (const unsigned char *octets, word_t *buffer, size_t n)
+{
+  return unpack_data8 (octets, buffer, n) != 0;
+}
+
+/* Pack n words to octets in data8 format. */
+void
+pack_data8_words (const word_t *buffer, unsigned char *octets, size_t n)
+{
+  pack_data8 (buffer, octets, n);
+}
@@ -23,25 +23,28 @@
 
 #include "libword.h"
 
+/* Number of words decoded from each read. */
+#define CHUNK 1024
+
 static int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c = stream_getc (s);
   return c == EOF ? 0 : c;
 }
 
 static word_t
-get_pt_word (FILE *f)
+get_pt_word (struct word_stream *s)
 {
   int i;
   word_t byte, word = 0;
 
   for (i = 0; i < 6; )
     {
-      if (feof (f))
+      if (stream_eof (s))
         return -1;
 
-      byte = get_byte (f);
+      byte = get_byte (s);
       if (byte & 0200)
         {
           word <<= 6;
@@ -53,15 +56,90 @@ get_pt_word (FILE *f)
   return word;
 }
 
+static size_t
+get_pt_words (struct word_stream *s, word_t *buffer, size_t n)
+{
+  unsigned char buffer_frames[6 * CHUNK];
+  const unsigned char *frames;
+  size_t i, m, need, got, count = 0;
+  word_t word = 0;
+  int k = 0;
+
+  while (count < n)
+    {
+      m = n - count;
+      if (m > CHUNK)
+        m = CHUNK;
+      /* Never read past the last frame of the last word asked for. */
+      need = 6 * m - k;
+      frames = stream_octets (s, buffer_frames, need, &got);
+      for (i = 0; i < got; i++)
+        {
+          if ((frames[i] & 0200) == 0)
+            continue;
+          word <<= 6;
+          word |= frames[i] & 077;
+          if (++k == 6)
+            {
+              buffer[count++] = word;
+              word = 0;
+              k = 0;
+            }
+        }
+      if (got < need)
+        break;
+    }
+
+  return count;
+}
+
 static void
-write_pt_word (FILE *f, word_t word)
+write_pt_words (struct word_stream *s, const word_t *buffer, size_t n)
 {
-  fputc (((word >> 30) & 0x3F) | 0x80, f);
-  fputc (((word >> 24) & 0x3F) | 0x80, f);
-  fputc (((word >> 18) & 0x3F) | 0x80, f);
-  fputc (((word >> 12) & 0x3F) | 0x80, f);
-  fputc (((word >>  6) & 0x3F) | 0x80, f);
-  fputc (( word        & 0x3F) | 0x80, f);
+  unsigned char frames[6 * CHUNK], *p;
+  size_t i, m;
+  word_t word;
+
+  for (; n > 0; n -= m, buffer += m)
+    {
+      m = n > CHUNK ? CHUNK : n;
+      for (i = 0, p = frames; i < m; i++, p += 6)
+        {
+          word = buffer[i];
+          p[0] = ((word >> 30) & 0x3F) | 0x80;
+          p[1] = ((word >> 24) & 0x3F) | 0x80;
+          p[2] = ((word >> 18) & 0x3F) | 0x80;
+          p[3] = ((word >> 12) & 0x3F) | 0x80;
+          p[4] = ((word >>  6) & 0x3F) | 0x80;
+          p[5] = ( word        & 0x3F) | 0x80;
+        }
+      fwrite (frames, 6, m, s->file);
+    }
+}
+
+static void
+write_pt_word (struct word_stream *s, word_t word)
+{
+  write_pt_words (s, &word, 1);
+}
+
+/* Data frames have the eighth hole punched.  Blank tape doesn't
+   count either way. */
+static int
+score_pt (const unsigned char *octets, size_t n, int whole)
+{
+  size_t i, good = 0, total = 0;
+
+  (void)whole;
+  for (i = 0; i < n; i++)
+    {
+      if (octets[i] == 0)
+        continue;
+      total++;
+      if (octets[i] & 0200)
+        good++;
+    }
+  return word_score (good, total, 0.5);
 }
 
 struct word_format pt_word_format = {
@@ -70,5 +148,12 @@ struct word_format pt_word_format = {
   NULL,
   NULL,
   write_pt_word,
-  NULL
+  NULL,
+  get_pt_words,
+  write_pt_words,
+  NULL,
+  NULL,
+  save_offset,
+  NULL,
+  score_pt
 };
@@ -20,13 +20,18 @@
 #include <stdlib.h>
 #include "libword.h"
 
-static int leftover, there_is_some_leftover = 0;
-static int carriage_return = 0;
+struct sail_state {
+  /* Input. */
+  int leftover, there_is_some_leftover;
+  /* Output. */
+  int carriage_return;
+};
 
 #define WORDMASK	(0777777777777LL)
 #define SIGNBIT		(0400000000000LL)
 
-static int sail (int c)
+/* Map a Unicode character to the SAIL character set, or -1. */
+static int sail_char (int c)
 {
   switch (c)
     {
@@ -56,16 +61,25 @@ static int sail (int c)
     case 021050: return 0037; //∨
     case 020621: return 0136; //↑
     case 020620: return 0137; //←
-    default:
+    default: return -1;
+    }
+}
+
+static int sail (int c)
+{
+  c = sail_char (c);
+  if (c == -1)
+    {
       fprintf (stderr, "[illegal character]\n");
       exit (1);
     }
+  return c;
 }
 
 static inline int
-get_byte (FILE *f)
+get_byte (struct word_stream *s)
 {
-  int c = fgetc (f);
+  int c = stream_getc (s);
   return c == EOF ? 0 : c;
 }
 
@@ -76,30 +90,37 @@ insert (word_t word, unsigned char byte, int *bits)
   return (word << 7) | byte;
 }
 
+static void *
+new_sail_state (void)
+{
+  return new_word_state (sizeof (struct sail_state));
+}
+
 static word_t
-get_sail_word (FILE *f)
+get_sail_word (struct word_stream *s)
 {
+  struct sail_state *state = s->state;
   unsigned char byte;
   word_t word;
   int bits;
 
-  if (feof (f))
+  if (stream_eof (s))
     return -1;
 
   word = 0;
   bits = 0;
 
-  if (there_is_some_leftover)
+  if (state->there_is_some_leftover)
     {
-      word = leftover;
+      word = state->leftover;
       bits = 7;
-      there_is_some_leftover = 0;
+      state->there_is_some_leftover = 0;
     }
 
   while (bits < 36)
     {
-      byte = get_byte (f);
-      if (feof (f))
+      byte = get_byte (s);
+      if (stream_eof (s))
 	{
 	  if (bits == 0)
 	    return -1;
@@ -129,22 +150,22 @@ get_sail_word (FILE *f)
       else if (byte >= 0300 && byte <= 0337)
 	{
 	  int c = (byte & 037) << 6;
-	  c |= get_byte (f) & 077;
+	  c |= get_byte (s) & 077;
 	  word = insert (word, sail (c), &bits);
 	}
       else if (byte >= 0340 && byte <= 0357)
 	{
 	  int c = (byte & 017) << 12;
-	  c |= (get_byte (f) & 077) << 6;
-	  c |= get_byte (f) & 077;
+	  c |= (get_byte (s) & 077) << 6;
+	  c |= get_byte (s) & 077;
 	  word = insert (word, sail (c), &bits);
 	}
       else if (byte >= 0360 && byte <= 0367)
 	{
 	  int c = (byte & 7) << 18;
-	  c |= (get_byte (f) & 077) << 12;
-	  c |= (get_byte (f) & 077) << 6;
-	  c |= get_byte (f) & 077;
+	  c |= (get_byte (s) & 077) << 12;
+	  c |= (get_byte (s) & 077) << 6;
+	  c |= get_byte (s) & 077;
 	  word = insert (word, sail (c), &bits);
 	}
       else
@@ -160,8 +181,8 @@ get_sail_word (FILE *f)
 	}
       else if (bits == 42)
 	{
-	  leftover = word & 0177;
-	  there_is_some_leftover = 1;
+	  state->leftover = word & 0177;
+	  state->there_is_some_leftover = 1;
 	  word >>= 7;
 	  word <<= 1;
 	}
@@ -177,10 +198,28 @@ get_sail_word (FILE *f)
 }
 
 static void
-rewind_sail_word (FILE *f)
+rewind_sail_word (struct word_stream *s)
 {
-  there_is_some_leftover = 0;
-  rewind (f);
+  struct sail_state *state = s->state;
+  state->there_is_some_leftover = 0;
+  stream_rewind (s);
+}
+
+static int
+save_sail_state (struct word_stream *s, struct word_checkpoint *c)
+{
+  struct sail_state *state = s->state;
+  if (state->there_is_some_leftover)
+    c->data = 0200 | state->leftover;
+  return 1;
+}
+
+static void
+restore_sail_state (struct word_stream *s, const struct word_checkpoint *c)
+{
+  struct sail_state *state = s->state;
+  state->there_is_some_leftover = (c->data & 0200) != 0;
+  state->leftover = c->data & 0177;
 }
 
 static void
@@ -246,9 +285,9 @@ static int unsail (int c)
 }
 
 static void
-write_char (FILE *f, char c)
+write_char (FILE *f, struct sail_state *state, char c)
 {
-  if (carriage_return)
+  if (state->carriage_return)
     {
       if (c == 012)
 	fputc ('\n', f);
@@ -258,15 +297,15 @@ write_char (FILE *f, char c)
   switch (c)
     {
     case 0000: break;
-    case 0012: if (!carriage_return) fputc (012, f); break;
-    case 0015: carriage_return = 1; break;
+    case 0012: if (!state->carriage_return) fputc (012, f); break;
+    case 0015: state->carriage_return = 1; break;
     default:   write_utf8 (f, unsail (c)); break;
     }
-  carriage_return = (c == 015);
+  state->carriage_return = (c == 015);
 }
 
 static void
-write_sail_word (FILE *f, word_t word)
+write_sail_word (struct word_stream *s, word_t word)
 {
   int i;
 
@@ -278,17 +317,59 @@ write_sail_word (FILE *f, word_t word)
 
   for (i = 0; i < 5; i++)
     {
-      write_char (f, (word >> 29) & 0177);
+      write_char (s->file, s->state, (word >> 29) & 0177);
       word <<= 7;
     }
 }
 
 static void
-flush_sail_word (FILE *f)
+flush_sail_word (struct word_stream *s)
 {
-  if (carriage_return)
-    fputc (015, f);
-  carriage_return = 0;
+  struct sail_state *state = s->state;
+  if (state->carriage_return)
+    fputc (015, s->file);
+  state->carriage_return = 0;
+}
+
+/* Decode as far as possible, with only the UTF-8 characters the
+   format knows about. */
+static int
+score_sail (const unsigned char *octets, size_t n, int whole)
+{
+  size_t i = 0, j, more;
+  int c;
+
+  (void)whole;
+  while (i < n)
+    {
+      c = octets[i];
+      if (c <= 0177)
+        {
+          i++;
+          continue;
+        }
+      else if (c >= 0300 && c <= 0337)
+        c &= 037, more = 1;
+      else if (c >= 0340 && c <= 0357)
+        c &= 017, more = 2;
+      else if (c >= 0360 && c <= 0367)
+        c &= 7, more = 3;
+      else
+        break;
+      if (i + more >= n)
+        break;
+      for (j = 1; j <= more; j++)
+        {
+          if ((octets[i + j] & 0300) != 0200)
+            break;
+          c = (c << 6) | (octets[i + j] & 077);
+        }
+      if (j <= more || sail_char (c) == -1)
+        break;
+      i += more + 1;
+    }
+
+  return word_score (i, n, 0.0);
 }
 
 struct word_format sail_word_format = {
@@ -297,5 +378,12 @@ struct word_format sail_word_format = {
   rewind_sail_word,
   NULL,
   write_sail_word,
-  flush_sail_word
+  flush_sail_word,
+  NULL,
+  NULL,
+  new_sail_state,
+  NULL,
+  save_sail_state,
+  restore_sail_state,
+  score_sail
 };
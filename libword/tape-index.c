@@ -0,0 +1,414 @@
+/* Copyright (C) 2026 Lars Brinkhoff <lars@nocrew.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* An index of the records in a tape image, for going straight to a
+   file on the tape.  It's kept in a sidecar file next to the image,
+   with the image name and ".index" added.  The sidecar starts with
+   the magic "TAPEIDX1", and the size and modification time of the
+   image it belongs to, and the number of records.  Then for each
+   record the offset of its length, and the length itself or a tape
+   mark, gap, or error code.  All numbers are little endian, eight
+   octets each, except the record length in four.  The sidecar is
+   only written if write_tape_index is set, since a tool reading an
+   image shouldn't leave files next to it unasked. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "libword.h"
+
+static const char magic[8] = "TAPEIDX1";
+
+int write_tape_index = 0;
+
+static void
+add_record (struct tape_index *index, long offset, unsigned reclen)
+{
+  struct tape_index_record *r;
+  size_t size;
+
+  if ((index->records & (index->records - 1)) == 0)
+    {
+      size = index->records == 0 ? 1024 : 2 * index->records;
+      r = realloc (index->record, size * sizeof *r);
+      if (r == NULL)
+        {
+          fprintf (stderr, "Out of memory.\n");
+          exit (1);
+        }
+      index->record = r;
+    }
+
+  r = &index->record[index->records++];
+  r->offset = offset;
+  r->reclen = reclen;
+}
+
+static unsigned
+get_reclen (const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* Read the record lengths of a tape image, skipping over the data.
+   The index ends before the first damaged record.  The file is left
+   where it was.  Return NULL if the image can't be seeked. */
+struct tape_index *
+index_tape (FILE *f)
+{
+  struct tape_index *index;
+  struct word_stream s;
+  unsigned char octets[5];
+  unsigned reclen;
+  long offset, start;
+
+  start = ftell (f);
+  if (start == -1)
+    return NULL;
+
+  index = calloc (1, sizeof *index);
+  if (index == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+
+  init_word_stream (&s, f, &tape_word_format);
+  rewind (f);
+  map_word_stream (&s);
+  start_decompress (&s);
+
+  for (;;)
+    {
+      offset = stream_tell (&s);
+      if (stream_read (&s, octets, 4) < 4)
+        break;
+      reclen = get_reclen (octets);
+      add_record (index, offset, reclen);
+      if (reclen == 0 || (reclen & 0x80000000))
+        continue;
+
+      /* Like read_9track, first try E-11 and then SIMH. */
+      stream_seek (&s, offset + 4 + reclen);
+      if (stream_read (&s, octets, 4) == 4 && get_reclen (octets) == reclen)
+        continue;
+      if ((reclen & 1) && stream_read (&s, octets + 4, 1) == 1
+          && get_reclen (octets + 1) == reclen)
+        continue;
+
+      /* Nothing after a damaged record can be trusted, but what
+         comes before it can still be found. */
+      index->records--;
+      index->damaged = 1;
+      fprintf (stderr, "Error in tape image format after record %lu.\n",
+               (unsigned long)index->records);
+      break;
+    }
+
+  free_word_stream (&s);
+  fseek (f, start, SEEK_SET);
+  return index;
+}
+
+void
+free_tape_index (struct tape_index *index)
+{
+  if (index == NULL)
+    return;
+  free (index->record);
+  free (index);
+}
+
+static void
+put_number (unsigned char *p, unsigned long long x, int n)
+{
+  int i;
+  for (i = 0; i < n; i++, x >>= 8)
+    p[i] = x & 0xFF;
+}
+
+static unsigned long long
+get_number (const unsigned char *p, int n)
+{
+  unsigned long long x = 0;
+  int i;
+  for (i = n - 1; i >= 0; i--)
+    x = (x << 8) | p[i];
+  return x;
+}
+
+static char *
+sidecar_name (const char *name)
+{
+  char *sidecar = malloc (strlen (name) + sizeof ".index");
+  if (sidecar == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  strcpy (sidecar, name);
+  strcat (sidecar, ".index");
+  return sidecar;
+}
+
+static struct tape_index *
+read_sidecar (const char *sidecar, const struct stat *st)
+{
+  struct tape_index *index;
+  unsigned char octets[32];
+  size_t i, records;
+  FILE *f;
+
+  f = fopen (sidecar, "rb");
+  if (f == NULL)
+    return NULL;
+
+  index = NULL;
+  if (fread (octets, 1, 32, f) != 32
+      || memcmp (octets, magic, sizeof magic) != 0
+      || get_number (octets + 8, 8) != (unsigned long long)st->st_size
+      || get_number (octets + 16, 8) != (unsigned long long)st->st_mtime)
+    goto out;
+
+  records = get_number (octets + 24, 8);
+  index = calloc (1, sizeof *index);
+  if (index == NULL)
+    {
+      fprintf (stderr, "Out of memory.\n");
+      exit (1);
+    }
+  for (i = 0; i < records; i++)
+    {
+      if (fread (octets, 1, 12, f) != 12)
+        {
+          free_tape_index (index);
+          index = NULL;
+          goto out;
+        }
+      add_record (index, get_number (octets, 8), get_number (octets + 8, 4));
+    }
+
+ out:
+  fclose (f);
+  return index;
+}
+
+static void
+write_sidecar (const char *sidecar, const struct stat *st,
+               const struct tape_index *index)
+{
+  unsigned char octets[32];
+  size_t i;
+  FILE *f;
+
+  f = fopen (sidecar, "wb");
+  if (f == NULL)
+    return;
+
+  memcpy (octets, magic, sizeof magic);
+  put_number (octets + 8, st->st_size, 8);
+  put_number (octets + 16, st->st_mtime, 8);
+  put_number (octets + 24, index->records, 8);
+  fwrite (octets, 1, 32, f);
+  for (i = 0; i < index->records; i++)
+    {
+      put_number (octets, index->record[i].offset, 8);
+      put_number (octets + 8, index->record[i].reclen, 4);
+      fwrite (octets, 1, 12, f);
+    }
+
+  /* A partial sidecar would be taken for a good one. */
+  if (fclose (f) != 0)
+    remove (sidecar);
+}
+
+/* Get the index of the tape image named name and opened as f, from
+   its sidecar if that's up to date, or else by reading the image and
+   maybe writing a new sidecar.  Return NULL if the image can't be
+   seeked. */
+struct tape_index *
+load_tape_index (const char *name, FILE *f)
+{
+  struct tape_index *index;
+  struct stat st;
+  char *sidecar;
+
+  if (fstat (fileno (f), &st) == -1 || !S_ISREG (st.st_mode))
+    return index_tape (f);
+
+  sidecar = sidecar_name (name);
+  index = read_sidecar (sidecar, &st);
+  if (index == NULL)
+    {
+      index = index_tape (f);
+      /* A damaged image is indexed again each time, so the error
+         isn't lost. */
+      if (index != NULL && !index->damaged && write_tape_index)
+        write_sidecar (sidecar, &st, index);
+    }
+  free (sidecar);
+  return index;
+}
+
+/* Make the next word read from f be the first of the given file on
+   the tape, counting from 0.  Files are separated by one or more tape
+   marks.  Return -1 if there is no such file. */
+int
+seek_tape_file (FILE *f, const struct tape_index *index, int file)
+{
+  const struct tape_index_record *r;
+  struct word_stream *s;
+  int n = -1, mark = 1, size;
+  long words = 0;
+  size_t i;
+
+  if (index == NULL)
+    return -1;
+  s = input_word_stream (f);
+  start_word_input (s);
+  if (s->format == &tape_word_format)
+    size = 5;
+  else if (s->format == &tape7_word_format)
+    size = 6;
+  else
+    {
+      fprintf (stderr, "Input word format is not a tape image.\n");
+      exit (1);
+    }
+
+  for (i = 0; i < index->records; i++)
+    {
+      r = &index->record[i];
+      if (r->reclen == 0)
+        mark = 1;
+      if (r->reclen == 0 || (r->reclen & 0x80000000))
+        continue;
+      if (mark && ++n == file)
+        {
+          /* The word count keeps seek_word and checkpoints right. */
+          stream_rewind_word (s);
+          stream_seek (s, r->offset);
+          s->position = words;
+          return 0;
+        }
+      mark = 0;
+      words += r->reclen / size;
+    }
+
+  return -1;
+}
+
+/* Find the record after the one f was last reading from.  Return -1
+   if f is in the middle of a record, or the index has no more. */
+static long
+next_record (struct word_stream *s, const struct tape_index *index,
+             int *size)
+{
+  struct word_checkpoint c;
+  size_t low = 0, high = index->records, middle;
+  long offset;
+
+  start_word_input (s);
+  if (s->format == &tape_word_format)
+    *size = 5;
+  else if (s->format == &tape7_word_format)
+    *size = 6;
+  else
+    return -1;
+  if (!s->format->save_state (s, &c) || (offset = stream_tell (s)) == -1)
+    return -1;
+
+  while (low < high)
+    {
+      middle = (low + high) / 2;
+      if (index->record[middle].offset < offset)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+  return low < index->records ? (long)low : -1;
+}
+
+/* Get the first n words of the next record on the tape, without
+   reading the rest of it or moving on.  Return the number of words
+   got, or 0 if the next thing on the tape isn't a record, or f is in
+   the middle of one. */
+int
+peek_tape_record (FILE *f, const struct tape_index *index,
+                  word_t *words, int n)
+{
+  struct word_stream *s = input_word_stream (f);
+  const struct tape_index_record *r;
+  unsigned char octets[6 * 8];
+  const unsigned char *q;
+  long i, offset;
+  int j, size;
+
+  i = next_record (s, index, &size);
+  if (i == -1)
+    return 0;
+  r = &index->record[i];
+  if (r->reclen == 0 || (r->reclen & 0x80000000))
+    return 0;
+  if (n > (int)(r->reclen / size))
+    n = r->reclen / size;
+  if (n > 8)
+    n = 8;
+
+  offset = stream_tell (s);
+  stream_seek (s, r->offset + 4);
+  n = stream_read (s, octets, n * size) / size;
+  stream_seek (s, offset);
+
+  if (size == 5)
+    unpack_core_words (octets, words, n);
+  else
+    for (j = 0, q = octets; j < n; j++, q += 6)
+      words[j] = (((word_t)q[0] & 077) << 30) |
+                 (((word_t)q[1] & 077) << 24) |
+                 (((word_t)q[2] & 077) << 18) |
+                 (((word_t)q[3] & 077) << 12) |
+                 (((word_t)q[4] & 077) <<  6) |
+                  ((word_t)q[5] & 077);
+  return n;
+}
+
+/* Go past the next record on the tape without reading it.  Return -1
+   if that can't be done, and the record is left to be read. */
+int
+skip_tape_record (FILE *f, const struct tape_index *index)
+{
+  struct word_stream *s = input_word_stream (f);
+  const struct tape_index_record *r;
+  struct word_checkpoint c;
+  long i;
+  int size;
+
+  i = next_record (s, index, &size);
+  if (i == -1 || (size_t)i + 1 >= index->records)
+    return -1;
+  r = &index->record[i];
+  if (r->reclen == 0 || (r->reclen & 0x80000000))
+    return -1;
+
+  /* Keep the decoder state as it is between records. */
+  s->format->save_state (s, &c);
+  stream_seek (s, r[1].offset);
+  s->format->restore_state (s, &c);
+  s->position += r->reclen / size;
+  return 0;
+}
@@ -15,46 +15,96 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "libword.h"
 
-/* Buffer for write_word. */
-static word_t record[65536];
-static int reclen = 0;
-static int beginning_of_tape = 1;
-static int marks = 0;
+/* Longest record written by write_word. */
+#define RECORD_WORDS 65536
+
+/* Number of words packed for each fwrite. */
+#define CHUNK 1024
+
+struct tape_state {
+  /* Input.  The buffer holds the current record, and is reused for
+     the next; the record is done when n reaches words. */
+  word_t *buffer;
+  int size, n, words;
+  word_t tape_bits;
+  /* Output. */
+  word_t *record;
+  int reclen;
+  int beginning_of_tape;
+  int marks;
+};
 
 static void tape_special (int code);
-static int get_tape_record (FILE *f, word_t **buffer);
 
 void (*tape_hook) (int code) = tape_special;
 
-static int
-get_byte (FILE *f)
+static void *
+new_tape_state (void)
 {
-  int c = fgetc (f);
-  return c == EOF ? 0 : c;
+  struct tape_state *state = new_word_state (sizeof *state);
+  state->tape_bits = START_FILE;
+  state->beginning_of_tape = 1;
+  return state;
 }
 
-static word_t
-get_7track_word (FILE *f)
+static void
+free_tape_state (void *x)
 {
-  word_t word;
+  struct tape_state *state = x;
+  free (state->buffer);
+  free (state->record);
+  free (state);
+}
 
-  if (feof (f))
-    return -1;
+/* The FILE based functions count tape marks in the default output
+   stream, if it's a tape. */
+static struct tape_state *
+output_tape_state (FILE *f)
+{
+  static struct tape_state other;
+  struct word_stream *s = output_word_stream (f);
+  if (s->format->new_state == new_tape_state)
+    return s->state;
+  return &other;
+}
 
-  word = (((word_t)get_byte (f) & 077) << 30) |
-         (((word_t)get_byte (f) & 077) << 24) |
-         (((word_t)get_byte (f) & 077) << 18) |
-         (((word_t)get_byte (f) & 077) << 12) |
-         (((word_t)get_byte (f) & 077) <<  6) |
-          ((word_t)get_byte (f) & 077);
+static int
+get_byte (struct word_stream *s)
+{
+  int c = stream_getc (s);
+  return c == EOF ? 0 : c;
+}
 
-  return word;
+/* The FILE based record functions read through a stream without a
+   word format.  It's kept from one record to the next, since it may
+   be decompressing the file.  At the end of the file, it's checked
+   again for compression, like the word streams. */
+static struct word_stream *
+file_stream (FILE *f)
+{
+  static struct word_stream s;
+
+  if (s.file != f)
+    {
+      free_word_stream (&s);
+      memset (&s, 0, sizeof s);
+      s.file = f;
+    }
+  else if (stream_eof (&s))
+    s.started = 0;
+  if (!s.started)
+    {
+      s.started = 1;
+      start_decompress (&s);
+    }
+  return &s;
 }
 
 static void
-write_7track_word (FILE *f, word_t word)
+pack_7track_word (unsigned char *frames, word_t word)
 {
   int i, c, p;
   
@@ -63,30 +113,67 @@ write_7track_word (FILE *f, word_t word)
       c = (word >> 30) & 077;
       p = 0100 ^ (c << 1) ^ (c << 2) ^ (c << 3) ^ (c << 4) ^ (c << 5) ^ (c << 6);
       c |= p & 0100;
-      fputc (c, f);
+      frames[i] = c;
       word <<= 6;
     }
 }
 
-static int get_reclen (FILE *f)
+/* Make sure the buffer, of *size words, has room for a record of the
+   given number of words, and return the record octets.  They are read
+   into the start of the buffer, unless the file is mapped and they
+   can be used from there. */
+static const unsigned char *
+read_record (struct word_stream *s, word_t **buffer, int *size,
+	     int words, int octets)
+{
+  const unsigned char *p;
+  word_t *q;
+  size_t got;
+
+  if (*buffer == NULL || words > *size)
+    {
+      q = realloc (*buffer, sizeof (word_t) * (words > 0 ? words : 1));
+      if (q == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      *buffer = q;
+      *size = words;
+    }
+
+  p = stream_octets (s, *buffer, octets, &got);
+  if (got < (size_t)octets)
+    {
+      memmove (*buffer, p, got);
+      memset ((unsigned char *)*buffer + got, 0, octets - got);
+      p = (unsigned char *)*buffer;
+    }
+  return p;
+}
+
+static int get_reclen (struct word_stream *s)
 {
-  return get_byte (f) |
-    ((word_t)get_byte (f) << 8) |
-    (get_byte (f) << 16) |
-    (get_byte (f) << 24);
+  return get_byte (s) |
+    ((word_t)get_byte (s) << 8) |
+    (get_byte (s) << 16) |
+    (get_byte (s) << 24);
 }
 
-static void write_reclen (FILE *f, int n)
+static void write_reclen (FILE *f, struct tape_state *state, int n)
 {
-  fputc (n & 0377, f);
-  fputc ((n >> 8) & 0377, f);
-  fputc ((n >> 16) & 0377, f);
-  fputc ((n >> 24) & 0377, f);
+  unsigned char octets[4];
+
+  octets[0] = n & 0377;
+  octets[1] = (n >> 8) & 0377;
+  octets[2] = (n >> 16) & 0377;
+  octets[3] = (n >> 24) & 0377;
+  fwrite (octets, 1, 4, f);
 
   if (n == 0)
-    marks++;
+    state->marks++;
   else
-    marks = 0;
+    state->marks = 0;
 }
 
 static void tape_special (int code)
@@ -105,18 +192,19 @@ static void tape_special (int code)
     }
 }
 
-int get_9track_record (FILE *f, word_t **buffer)
+static int
+read_9track (struct word_stream *s, word_t **buffer, int *size)
 {
-  int i, x, reclen;
-  word_t *p;
+  const unsigned char *octets;
+  int x, reclen;
 
-  reclen = get_reclen (f);
+  reclen = get_reclen (s);
   if (reclen == 0)
     return 0;
   else if (reclen & 0x80000000)
     {
       tape_hook (reclen);
-      return get_tape_record (f, buffer);
+      return read_9track (s, buffer, size);
     }
 
   if (reclen % 5)
@@ -125,24 +213,18 @@ int get_9track_record (FILE *f, word_t **buffer)
 	       "reclen = %d\n", reclen);
       exit (1);
     }
-  
-  *buffer = malloc (sizeof (word_t) * (reclen/5));
-  if (*buffer == NULL)
-    {
-      fprintf (stderr, "Out of memory.\n");
-      exit (1);
-    }
 
-  for (i = 0, p = *buffer; i < (reclen / 5); i++)
-    *p++ = get_core_word (f);
+  /* The words may be unpacked in place, over the octets. */
+  octets = read_record (s, buffer, size, reclen / 5, reclen);
+  unpack_core_words (octets, *buffer, reclen / 5);
 
   /* First try the E-11 tape format. */
-  x = get_reclen (f);
+  x = get_reclen (s);
   if (x != reclen)
     {
       /* Next try the SIMH tape format. */
       if (reclen & 1)
-	x = (x >> 8) + (get_byte (f) << 24);
+	x = (x >> 8) + (get_byte (s) << 24);
 
       if (x != reclen)
 	{
@@ -152,31 +234,54 @@ int get_9track_record (FILE *f, word_t **buffer)
 	}
     }
 
-  if (reclen == 0)
-    {
-      free (*buffer);
-    }
-
   return reclen / 5;
 }
 
-void write_7track_record (FILE *f, word_t *buffer, int n)
+int get_9track_record (FILE *f, word_t **buffer)
 {
-  int i;
+  int size = 0;
+  *buffer = NULL;
+  return read_9track (file_stream (f), buffer, &size);
+}
 
-  write_reclen (f, 6 * n);
+int read_9track_record (FILE *f, word_t **buffer, int *size)
+{
+  return read_9track (file_stream (f), buffer, size);
+}
+
+static void
+write_7track (FILE *f, struct tape_state *state, word_t *buffer, int n)
+{
+  unsigned char frames[6 * CHUNK];
+  int i, j, m;
+
+  write_reclen (f, state, 6 * n);
   if (n == 0)
     return;
   
-  for (i = 0; i < n; i++)
-    write_7track_word (f, *buffer++);
+  for (i = 0; i < n; i += m)
+    {
+      m = n - i;
+      if (m > CHUNK)
+	m = CHUNK;
+      for (j = 0; j < m; j++)
+	pack_7track_word (frames + 6 * j, buffer[i + j]);
+      fwrite (frames, 6, m, f);
+    }
 
-  write_reclen (f, 6 * n);
+  write_reclen (f, state, 6 * n);
 }
 
-void write_9track_record (FILE *f, word_t *buffer, int n)
+void write_7track_record (FILE *f, word_t *buffer, int n)
 {
-  int i;
+  write_7track (f, output_tape_state (f), buffer, n);
+}
+
+static void
+write_9track (FILE *f, struct tape_state *state, word_t *buffer, int n)
+{
+  unsigned char octets[5 * CHUNK];
+  int i, m;
 
   /* To write a tape record in the SIMH tape image format, first write
      a 32-bit record length, then data frames, then the length again.
@@ -184,35 +289,48 @@ void write_9track_record (FILE *f, word_t *buffer, int n)
      dump" format.  One word is written as five 8-bit frames, with
      four bits unused in the last frame. */
 
-  write_reclen (f, 5 * n);
+  write_reclen (f, state, 5 * n);
 
   /* A record of length zero is a tape mark, and the length is only
      written once. */
   if (n == 0)
     return;
   
-  for (i = 0; i < n; i++)
-    write_core_word (f, *buffer++);
+  for (i = 0; i < n; i += m)
+    {
+      m = n - i;
+      if (m > CHUNK)
+	m = CHUNK;
+      pack_core_words (buffer + i, octets, m);
+      fwrite (octets, 5, m, f);
+    }
 
   /* Pad out to make the record data an even number of octets. */
   if ((n * 5) & 1)
     fputc (0, f);
 
-  write_reclen (f, 5 * n);
+  write_reclen (f, state, 5 * n);
 }
 
-int get_7track_record (FILE *f, word_t **buffer)
+void write_9track_record (FILE *f, word_t *buffer, int n)
+{
+  write_9track (f, output_tape_state (f), buffer, n);
+}
+
+static int
+read_7track (struct word_stream *s, word_t **buffer, int *size)
 {
   int i, x, reclen;
+  const unsigned char *q;
   word_t *p;
 
-  reclen = get_reclen (f);
+  reclen = get_reclen (s);
   if (reclen == 0)
     return 0;
   else if (reclen & 0x80000000)
     {
       tape_hook (reclen);
-      return get_tape_record (f, buffer);
+      return read_7track (s, buffer, size);
     }
 
   if (reclen % 6)
@@ -221,18 +339,23 @@ int get_7track_record (FILE *f, word_t **buffer)
 	       "reclen = %d\n", reclen);
       exit (1);
     }
-  
-  *buffer = malloc (sizeof (word_t) * (reclen/6));
-  if (*buffer == NULL)
+
+  /* Unpack in place, starting from the end since each word takes
+     more room than its frames. */
+  q = read_record (s, buffer, size, reclen / 6, reclen) + reclen;
+  p = *buffer + reclen / 6;
+  for (i = 0; i < (reclen / 6); i++)
     {
-      fprintf (stderr, "Out of memory.\n");
-      exit (1);
+      q -= 6;
+      *--p = (((word_t)q[0] & 077) << 30) |
+             (((word_t)q[1] & 077) << 24) |
+             (((word_t)q[2] & 077) << 18) |
+             (((word_t)q[3] & 077) << 12) |
+             (((word_t)q[4] & 077) <<  6) |
+              ((word_t)q[5] & 077);
     }
 
-  for (i = 0, p = *buffer; i < (reclen / 6); i++)
-    *p++ = get_7track_word (f);
-
-  x = get_reclen (f);
+  x = get_reclen (s);
   if (x != reclen)
     {
       fprintf (stderr, "Error in tape image format.\n"
@@ -240,162 +363,312 @@ int get_7track_record (FILE *f, word_t **buffer)
       exit (1);
     }
 
-  if (reclen == 0)
-    {
-      free (*buffer);
-    }
-
   return reclen / 6;
 }
 
-static word_t *buffer = NULL;
-static int n, words;
-static word_t tape_bits = START_FILE;
+int get_7track_record (FILE *f, word_t **buffer)
+{
+  int size = 0;
+  *buffer = NULL;
+  return read_7track (file_stream (f), buffer, &size);
+}
+
+int read_7track_record (FILE *f, word_t **buffer, int *size)
+{
+  return read_7track (file_stream (f), buffer, size);
+}
 
 static int
-get_tape_record (FILE *f, word_t **buffer)
+get_tape_record (struct word_stream *s, struct tape_state *state)
 {
-  if (input_word_format == &tape_word_format)
-    return get_9track_record (f, buffer);
+  if (s->format == &tape_word_format)
+    return read_9track (s, &state->buffer, &state->size);
   else
-    return get_7track_record (f, buffer);
+    return read_7track (s, &state->buffer, &state->size);
 }
 
 static word_t
-get_tape_word (FILE *f)
+get_tape_word (struct word_stream *s)
 {
+  struct tape_state *state = s->state;
   word_t word;
 
-  if (buffer == NULL)
+  if (state->n == state->words)
     {
-      words = get_tape_record (f, &buffer);
-      if (words == 0)
+      state->n = 0;
+      state->words = get_tape_record (s, state);
+      if (state->words == 0)
 	{
 	  /* Seen one tape mark.  Is this EOF or EOT? */
-	  words = get_tape_record (f, &buffer);
-	  if (words == 0)
+	  state->words = get_tape_record (s, state);
+	  if (state->words == 0)
 	    {
-	      while (words == 0)
+	      while (state->words == 0)
 		{
 		  /* Seen two or more tape marks.  Is this pysical or
 		     logical EOT? */
-		  words = get_tape_record (f, &buffer);
-		  if (feof (f))
+		  state->words = get_tape_record (s, state);
+		  if (stream_eof (s))
 		    /* End of input file means physical end of tape. */
 		    return -1;
 		}
 	      /* More data in input file; it was logical end of tape. */
-	      tape_bits = START_TAPE;
+	      state->tape_bits = START_TAPE;
 	    }
 	  else
-	    tape_bits = START_FILE;
+	    state->tape_bits = START_FILE;
 	}
-      else if (tape_bits == 0)
-	tape_bits = START_RECORD;
-      n = 0;
+      else if (state->tape_bits == 0)
+	state->tape_bits = START_RECORD;
     }
 
-  word = buffer[n++];
-  word |= tape_bits;
-  tape_bits = 0;
+  word = state->buffer[state->n++];
+  word |= state->tape_bits;
+  state->tape_bits = 0;
+  return word;
+}
+
+static size_t
+get_tape_words (struct word_stream *s, word_t *out, size_t count)
+{
+  struct tape_state *state = s->state;
+  size_t i = 0, m;
+  word_t word;
 
-  if (n == words)
+  while (i < count)
     {
-      free (buffer);
-      buffer = NULL;
+      /* Let get_tape_word deal with record boundaries and tape marks,
+	 then copy as much as possible of the record in one go. */
+      if ((word = get_tape_word (s)) == -1)
+	break;
+      out[i++] = word;
+
+      m = state->words - state->n;
+      if (m > count - i)
+	m = count - i;
+      memcpy (out + i, state->buffer + state->n, m * sizeof (word_t));
+      i += m;
+      state->n += m;
+
+      /* Return at the end of a record, so the caller can process it
+	 before the next one is read. */
+      break;
     }
 
-  return word;
+  return i;
 }
 
 static void
-rewind_tape_word (FILE *f)
+rewind_tape_word (struct word_stream *s)
 {
-  if (buffer != NULL)
-    free (buffer);
-  tape_bits = START_FILE;
-  buffer = NULL;
-  rewind (f);
+  struct tape_state *state = s->state;
+  state->tape_bits = START_FILE;
+  state->n = state->words = 0;
+  stream_rewind (s);
+}
+
+/* Checkpoints are only made between records. */
+static int
+save_tape_state (struct word_stream *s, struct word_checkpoint *c)
+{
+  struct tape_state *state = s->state;
+  if (state->n != state->words)
+    return 0;
+  c->data = state->tape_bits;
+  return 1;
 }
 
 static void
-write_tape_record (FILE *f, word_t *buffer, int n)
+restore_tape_state (struct word_stream *s, const struct word_checkpoint *c)
 {
-  if (output_word_format == &tape_word_format)
-    write_9track_record (f, buffer, n);
+  struct tape_state *state = s->state;
+  state->n = state->words = 0;
+  state->tape_bits = c->data;
+}
+
+static void
+write_tape_record (FILE *f, struct tape_state *state,
+		   struct word_format *format, word_t *buffer, int n)
+{
+  if (format == &tape_word_format)
+    write_9track (f, state, buffer, n);
   else
-    write_7track_record (f, buffer, n);
+    write_7track (f, state, buffer, n);
+}
+
+static void
+tape_eof (FILE *f, struct tape_state *state, struct word_format *format)
+{
+  while (state->marks < 1)
+    write_tape_record (f, state, format, NULL, 0);
+}
+
+static void
+tape_eot (FILE *f, struct tape_state *state, struct word_format *format)
+{
+  while (state->marks < 2)
+    write_tape_record (f, state, format, NULL, 0);
 }
 
 void
 write_tape_mark (FILE *f)
 {
-  write_tape_record (f, NULL, 0);
+  write_tape_record (f, output_tape_state (f), output_word_format, NULL, 0);
 }
 
 void
 write_tape_eof (FILE *f)
 {
-  while (marks < 1)
-    write_tape_mark (f);
+  tape_eof (f, output_tape_state (f), output_word_format);
 }
 
 void
 write_tape_eot (FILE *f)
 {
-  while (marks < 2)
-    write_tape_mark (f);
+  tape_eot (f, output_tape_state (f), output_word_format);
 }
 
 void
 write_tape_gap (FILE *f, unsigned code)
 {
-  write_reclen (f, 0xFF000000 | (code & 0xFFFFFF));
+  write_reclen (f, output_tape_state (f), 0xFF000000 | (code & 0xFFFFFF));
 }
 
 void
 write_tape_error (FILE *f, unsigned code)
 {
-  write_reclen (f, 0x80000000 | (code & 0xFFFFFF));
+  write_reclen (f, output_tape_state (f), 0x80000000 | (code & 0xFFFFFF));
 }
 
 static void
-flush_record (FILE *f)
+flush_record (struct word_stream *s)
 {
-  write_tape_record (f, record, reclen);
-  reclen = 0;
+  struct tape_state *state = s->state;
+  write_tape_record (s->file, state, s->format, state->record, state->reclen);
+  state->reclen = 0;
 }
 
 static void
-write_tape_word (FILE *f, word_t word)
+write_tape_word (struct word_stream *s, word_t word)
 {
-  if (!beginning_of_tape)
+  struct tape_state *state = s->state;
+
+  if (!state->beginning_of_tape)
     {
       if (word & (START_RECORD|START_FILE|START_TAPE))
-	flush_record (f);
+	flush_record (s);
       if (word & START_FILE)
-	write_tape_eof (f);
+	tape_eof (s->file, state, s->format);
       if (word & START_TAPE)
-	write_tape_eot (f);
+	tape_eot (s->file, state, s->format);
     }
-  beginning_of_tape = 0;
+  state->beginning_of_tape = 0;
 
-  if (reclen == sizeof record)
+  if (state->record == NULL)
+    state->record = new_word_state (sizeof (word_t) * RECORD_WORDS);
+
+  if (state->reclen == RECORD_WORDS)
     {
       fprintf (stderr, "Output tape record too large.\n");
       exit (1);
     }
 
-  record[reclen++] = word;
+  state->record[state->reclen++] = word;
 }
 
 static void
-flush_tape_word (FILE *f)
+flush_tape_word (struct word_stream *s)
+{
+  struct tape_state *state = s->state;
+  flush_record (s);
+  tape_eot (s->file, state, s->format);
+  state->beginning_of_tape = 1;
+  state->marks = 0;
+}
+
+static unsigned
+get_reclen_at (const unsigned char *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+/* Follow the records, counting the octets which make sense.  A record
+   length must be a whole number of words and be repeated after the
+   record, and the unused bits of each word must be zero.  The last
+   record may run past the octets at hand, unless they are the whole
+   file. */
+static int
+score_tape (const unsigned char *octets, size_t n, int whole, unsigned size)
+{
+  size_t i = 0, j, end, good = 0, before;
+  unsigned reclen, code;
+  int records = 0;
+
+  while (i + 4 <= n)
+    {
+      reclen = get_reclen_at (octets + i);
+      code = reclen >> 24;
+      if (reclen == 0 || code == 0x80 || code == 0xFF)
+        {
+          good += 4;
+          i += 4;
+          continue;
+        }
+      if (reclen % size != 0 || reclen > 0xFFFFFF)
+        break;
+
+      end = i + 4 + reclen;
+      before = good;
+      for (j = i + 4; j + size <= end && j + size <= n; j += size)
+        {
+          if (size == 5 ? (octets[j + 4] & 0xF0) != 0
+              : ((octets[j] | octets[j + 1] | octets[j + 2] | octets[j + 3]
+                  | octets[j + 4] | octets[j + 5]) & 0200) != 0)
+            continue;
+          good += size;
+        }
+      records++;
+
+      if (end + 4 > n && whole)
+        {
+          /* Cut short, so not a tape after all. */
+          good = before;
+          records--;
+          break;
+        }
+      if (end + 4 > n)
+        {
+          good += 4 + (j < n ? n - j : 0);
+          i = n;
+          break;
+        }
+      if (get_reclen_at (octets + end) == reclen)
+        end += 4;
+      else if (size == 5 && (reclen & 1) && end + 5 <= n
+               && get_reclen_at (octets + end + 1) == reclen)
+        end += 5;
+      else
+        break;
+      good += end - i - reclen;
+      i = end;
+    }
+
+  /* Nothing but tape marks is a poor excuse for a tape. */
+  if (records == 0)
+    good /= 2;
+  return word_score (good, n, 0.0);
+}
+
+static int
+score_9track (const unsigned char *octets, size_t n, int whole)
+{
+  return score_tape (octets, n, whole, 5);
+}
+
+static int
+score_7track (const unsigned char *octets, size_t n, int whole)
 {
-  flush_record (f);
-  write_tape_eot (f);
-  beginning_of_tape = 1;
-  marks = 0;
+  return score_tape (octets, n, whole, 6);
 }
 
 struct word_format tape_word_format = {
@@ -404,7 +677,14 @@ struct word_format tape_word_format = {
   rewind_tape_word,
   NULL,
   write_tape_word,
-  flush_tape_word
+  flush_tape_word,
+  get_tape_words,
+  NULL,
+  new_tape_state,
+  free_tape_state,
+  save_tape_state,
+  restore_tape_state,
+  score_9track
 };
 
 struct word_format tape7_word_format = {
@@ -413,5 +693,12 @@ struct word_format tape7_word_format = {
   rewind_tape_word,
   NULL,
   write_tape_word,
-  flush_tape_word
+  flush_tape_word,
+  get_tape_words,
+  NULL,
+  new_tape_state,
+  free_tape_state,
+  save_tape_state,
+  restore_tape_state,
+  score_7track
 };
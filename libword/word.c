@@ -16,9 +16,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "libword.h"
 
+/* Words between checkpoints for seeking in formats which can't seek
+   directly. */
+#define CHECKPOINT_WORDS 1024
+
+/* Octets to look ahead for peek_word. */
+#define PEEK_OCTETS (64 * 1024)
+
 struct word_format *input_word_format = &its_word_format;
 struct word_format *output_word_format = &its_word_format;
 
@@ -38,7 +46,10 @@ static struct word_format *word_formats[] = {
   &tape7_word_format,
   NULL
 };
-static word_t checksum;
+
+/* Default streams for the FILE based functions. */
+static struct word_stream input_stream;
+static struct word_stream output_stream;
 
 void
 usage_word_format (void)
@@ -49,6 +60,7 @@ usage_word_format (void)
   for (i = 0; word_formats[i] != NULL; i++)
     fprintf (stderr, " %s", word_formats[i]->name);
   fprintf (stderr, "\n");
+  fprintf (stderr, "For input, auto guesses the format from the file contents.\n");
 }
 
 static int
@@ -69,6 +81,11 @@ parse_word_format (const char *string, struct word_format **word_format)
 int
 parse_input_word_format (const char *string)
 {
+  if (strcmp (string, auto_word_format.name) == 0)
+    {
+      input_word_format = &auto_word_format;
+      return 0;
+    }
   return parse_word_format (string, &input_word_format);
 }
 
@@ -78,97 +95,539 @@ parse_output_word_format (const char *string)
   return parse_word_format (string, &output_word_format);
 }
 
-word_t
-get_word (FILE *f)
+/* Allocate zeroed state for a word format. */
+void *
+new_word_state (size_t size)
 {
-  if (input_word_format->get_word == NULL)
+  void *state = calloc (1, size);
+  if (state == NULL)
     {
-      fprintf (stderr, "word format \"%s\" not supported for input\n", input_word_format->name);
+      fprintf (stderr, "Out of memory.\n");
       exit (1);
     }
-  return input_word_format->get_word (f);
+  return state;
 }
 
 void
-rewind_word (FILE *f)
+init_word_stream (struct word_stream *s, FILE *f, struct word_format *format)
+{
+  s->file = f;
+  s->format = s->requested = format;
+  s->state = format->new_state == NULL ? NULL : format->new_state ();
+  s->checksum = 0;
+  s->position = 0;
+  s->checkpoints = NULL;
+  s->checkpoints_used = s->checkpoints_size = 0;
+  s->map = NULL;
+  s->peek = NULL;
+  s->peek_size = s->peek_offset = 0;
+  s->decompress = NULL;
+  s->started = 0;
+  s->ended = 0;
+}
+
+static void
+forget_checkpoints (struct word_stream *s)
+{
+  free (s->checkpoints);
+  s->checkpoints = NULL;
+  s->checkpoints_used = s->checkpoints_size = 0;
+}
+
+static void
+free_state (struct word_stream *s)
+{
+  if (s->state == NULL)
+    return;
+  if (s->format->free_state == NULL)
+    free (s->state);
+  else
+    s->format->free_state (s->state);
+  s->state = NULL;
+}
+
+void
+free_word_stream (struct word_stream *s)
+{
+  unmap_word_stream (s);
+  drop_peek (s);
+  forget_checkpoints (s);
+  free_state (s);
+}
+
+/* A guessed format lasts until the end of the file, since the same
+   FILE may be opened on another file next.  That file may or may not
+   be compressed, too. */
+static void
+forget_guess (struct word_stream *s)
 {
-  if (input_word_format->rewind_word == NULL)
+  s->started = 0;
+  if (s->requested != &auto_word_format || s->format == s->requested)
+    return;
+  forget_checkpoints (s);
+  free_state (s);
+  s->format = s->requested;
+}
+
+/* At the end of the file, let go of everything about it, since the
+   same FILE may be opened on another file next.  The FILE is left at
+   the end, so reading on gets nothing more from this file. */
+static void
+end_word_input (struct word_stream *s)
+{
+  forget_guess (s);
+  unmap_word_stream (s);
+  drop_peek (s);
+  if (fseek (s->file, 0, SEEK_END) == 0)
+    fgetc (s->file);
+  forget_checkpoints (s);
+  s->position = 0;
+  s->ended = 1;
+}
+
+/* Bind a default stream to a file.  The state is kept as long as the
+   word format doesn't change, even if the file does. */
+static struct word_stream *
+default_stream (struct word_stream *s, struct word_format *format, FILE *f)
+{
+  if (s->requested != format)
     {
-      rewind (f);
-      return;
+      if (s->format != NULL)
+        {
+          /* Octets pushed back or being decompressed still belong to
+             the file. */
+          if (s->file != f)
+            {
+              unmap_word_stream (s);
+              drop_peek (s);
+              s->started = 0;
+            }
+          else if (s->decompress == NULL)
+            unmap_word_stream (s);
+          forget_checkpoints (s);
+          free_state (s);
+        }
+      s->format = s->requested = format;
+      s->state = format->new_state == NULL ? NULL : format->new_state ();
+      s->position = 0;
     }
+  else if (s->file != f)
+    {
+      unmap_word_stream (s);
+      drop_peek (s);
+      s->started = 0;
+      s->ended = 0;
+      forget_checkpoints (s);
+      s->position = 0;
+      if (s->format != format)
+        forget_guess (s);
+    }
+  s->file = f;
+  return s;
+}
 
-  input_word_format->rewind_word (f);
+struct word_stream *
+input_word_stream (FILE *f)
+{
+  return default_stream (&input_stream, input_word_format, f);
+}
+
+struct word_stream *
+output_word_stream (FILE *f)
+{
+  return default_stream (&output_stream, output_word_format, f);
 }
 
+/* Before the first read, see if the input is compressed, and guess
+   the format if asked to. */
 void
-seek_word (FILE *f, int position)
+start_word_input (struct word_stream *s)
+{
+  if (!s->started)
+    {
+      s->started = 1;
+      start_decompress (s);
+    }
+  if (s->format == &auto_word_format)
+    guess_word_stream (s);
+}
+
+/* Remember where the stream is, if it's been a while since the last
+   checkpoint and the format can say how to resume from here. */
+static void
+checkpoint (struct word_stream *s)
+{
+  struct word_checkpoint *c;
+  long last = 0;
+
+  if (s->checkpoints_used > 0)
+    last = s->checkpoints[s->checkpoints_used - 1].position;
+  if (s->position < last + CHECKPOINT_WORDS || stream_eof (s))
+    return;
+
+  if (s->checkpoints_used == s->checkpoints_size)
+    {
+      s->checkpoints_size = 2 * s->checkpoints_size + 16;
+      c = realloc (s->checkpoints, s->checkpoints_size * sizeof *c);
+      if (c == NULL)
+	{
+	  fprintf (stderr, "Out of memory.\n");
+	  exit (1);
+	}
+      s->checkpoints = c;
+    }
+
+  c = &s->checkpoints[s->checkpoints_used];
+  c->position = s->position;
+  c->offset = stream_tell (s);
+  c->data = 0;
+  /* Not seekable, or the format can't resume here. */
+  if (c->offset == -1 || !s->format->save_state (s, c))
+    return;
+  s->checkpoints_used++;
+}
+
+word_t
+stream_get_word (struct word_stream *s)
+{
+  word_t word;
+
+  start_word_input (s);
+  if (s->format->get_word == NULL)
+    {
+      fprintf (stderr, "word format \"%s\" not supported for input\n", s->format->name);
+      exit (1);
+    }
+  word = s->format->get_word (s);
+  if (word == -1)
+    {
+      end_word_input (s);
+      return word;
+    }
+  s->position++;
+  if (s->format->save_state != NULL)
+    checkpoint (s);
+  return word;
+}
+
+/* Read up to n words into buffer.  Return the number of words read,
+   or 0 at the end of the file.  Fewer than n words may be returned
+   before the end, e.g. tape formats return at most one record. */
+size_t
+stream_get_words (struct word_stream *s, word_t *buffer, size_t n)
+{
+  word_t word;
+
+  start_word_input (s);
+  if (s->format->get_words != NULL)
+    {
+      n = s->format->get_words (s, buffer, n);
+      if (n == 0)
+        {
+          end_word_input (s);
+          return 0;
+        }
+      s->position += n;
+      if (s->format->save_state != NULL)
+        checkpoint (s);
+      return n;
+    }
+
+  /* Decoding one word at a time, there is nothing to gain from
+     filling the buffer.  Returning each word as soon as possible
+     means the caller gets all good data before a format error. */
+  if (n == 0 || (word = stream_get_word (s)) == -1)
+    return 0;
+  buffer[0] = word;
+  return 1;
+}
+
+/* Read the rest of the file into *buffer, which holds *size words and
+   is enlarged as needed.  Return the number of words. */
+size_t
+stream_get_all_words (struct word_stream *s, word_t **buffer, size_t *size)
 {
-  if (input_word_format->seek_word == NULL)
+  size_t n = 0, got;
+  word_t *p;
+
+  for (;;)
     {
-      input_word_format->rewind_word (f);
-      while (position-- > 0)
-        get_word (f);
+      if (n == *size)
+        {
+          *size = *size == 0 ? 4096 : 2 * *size;
+          p = realloc (*buffer, *size * sizeof *p);
+          if (p == NULL)
+            {
+              fprintf (stderr, "Out of memory.\n");
+              exit (1);
+            }
+          *buffer = p;
+        }
+      got = stream_get_words (s, *buffer + n, *size - n);
+      if (got == 0)
+        return n;
+      n += got;
+    }
+}
+
+/* The number of words left in the file, if the size of the file tells,
+   or else -1.  That's only for data8, which has exactly eight octets
+   per word; the other fixed size formats may decode an extra word from
+   a partial one at the end.  Compressed input has to be decoded. */
+long
+stream_words_left (struct word_stream *s)
+{
+  struct stat st;
+  long offset;
+
+  start_word_input (s);
+  if (s->format != &data8_word_format || s->decompress != NULL)
+    return -1;
+  if (fstat (fileno (s->file), &st) == -1 || !S_ISREG (st.st_mode)
+      || (offset = stream_tell (s)) == -1)
+    return -1;
+  return (st.st_size - offset) / 8;
+}
+
+/* Go back to the start of the file, keeping the checkpoints. */
+static void
+rewind_input (struct word_stream *s)
+{
+  s->position = 0;
+  s->ended = 0;
+  if (s->format->rewind_word == NULL)
+    stream_rewind (s);
+  else
+    s->format->rewind_word (s);
+}
+
+void
+stream_rewind_word (struct word_stream *s)
+{
+  forget_checkpoints (s);
+  rewind_input (s);
+}
+
+/* Find the last checkpoint at or before position. */
+static const struct word_checkpoint *
+find_checkpoint (struct word_stream *s, int position)
+{
+  size_t low = 0, high = s->checkpoints_used, middle;
+
+  while (low < high)
+    {
+      middle = (low + high) / 2;
+      if (s->checkpoints[middle].position <= position)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+  return low == 0 ? NULL : &s->checkpoints[low - 1];
+}
+
+void
+stream_seek_word (struct word_stream *s, int position)
+{
+  const struct word_checkpoint *c;
+
+  /* The position doesn't count from the start of the file after the
+     end, so go back there first. */
+  if (s->ended)
+    rewind_input (s);
+  start_word_input (s);
+  if (s->format->seek_word != NULL)
+    {
+      s->format->seek_word (s, position);
+      s->position = position;
       return;
     }
 
-  input_word_format->rewind_word (f);
+  /* Go forward from where the stream is, unless it's behind the
+     position or there is a checkpoint closer to it. */
+  c = find_checkpoint (s, position);
+  if (position < s->position || (c != NULL && c->position > s->position))
+    {
+      rewind_input (s);
+      if (c != NULL)
+        {
+          stream_seek (s, c->offset);
+          if (s->format->restore_state != NULL)
+            s->format->restore_state (s, c);
+          s->position = c->position;
+        }
+    }
+
+  while (s->position < position && stream_get_word (s) != -1)
+    ;
 }
 
 void
-by_five_octets (FILE *f, int position)
+by_five_octets (struct word_stream *s, int position)
 {
-  input_word_format->rewind_word (f);
-  fseek (f, 5 * position, SEEK_SET);
+  stream_rewind_word (s);
+  stream_seek (s, 5 * position);
 }
 
 void
-by_eight_octets (FILE *f, int position)
+by_eight_octets (struct word_stream *s, int position)
 {
-  input_word_format->rewind_word (f);
-  fseek (f, 8 * position, SEEK_SET);
+  stream_rewind_word (s);
+  stream_seek (s, 8 * position);
+}
+
+/* A save_state for formats where the file offset is all it takes to
+   resume decoding. */
+int
+save_offset (struct word_stream *s, struct word_checkpoint *c)
+{
+  (void)s;
+  (void)c;
+  return 1;
 }
 
 void
-write_word (FILE *f, word_t word)
+stream_write_word (struct word_stream *s, word_t word)
 {
-  if (output_word_format->write_word == NULL)
+  if (s->format->write_word == NULL)
     {
-      fprintf (stderr, "word format \"%s\" not supported for output\n", output_word_format->name);
+      fprintf (stderr, "word format \"%s\" not supported for output\n", s->format->name);
       exit (1);
     }
-  output_word_format->write_word (f, word);
+  s->format->write_word (s, word);
 }
 
+/* Write n words from buffer. */
 void
-flush_word (FILE *f)
+stream_write_words (struct word_stream *s, const word_t *buffer, size_t n)
+{
+  size_t i;
+
+  if (s->format->write_words == NULL)
+    {
+      for (i = 0; i < n; i++)
+        stream_write_word (s, buffer[i]);
+      return;
+    }
+
+  s->format->write_words (s, buffer, n);
+}
+
+void
+stream_flush_word (struct word_stream *s)
 {
-  if (output_word_format->flush_word == NULL)
+  if (s->format->flush_word == NULL)
     return;
 
-  output_word_format->flush_word (f);
+  s->format->flush_word (s);
+}
+
+word_t
+stream_get_checksummed_word (struct word_stream *s)
+{
+  word_t word = stream_get_word (s);
+
+  s->checksum = (s->checksum << 1) + (s->checksum >> 35) + word;
+  s->checksum &= 0777777777777ULL;
+
+  return word;
+}
+
+/* Look ahead at the next word.  Its octets are kept in the stream, so
+   at the start of the file this works on a pipe too. */
+word_t
+stream_peek_word (struct word_stream *s)
+{
+  long position = s->position;
+  size_t got;
+  word_t word;
+
+  if (position != 0 && s->map == NULL && s->decompress == NULL
+      && ftell (s->file) == -1)
+    {
+      fprintf (stderr, "Can't look ahead in unseekable input.\n");
+      exit (1);
+    }
+  stream_peek (s, PEEK_OCTETS, &got);
+  word = stream_get_word (s);
+  stream_seek_word (s, position);
+  return word;
+}
+
+word_t
+get_word (FILE *f)
+{
+  return stream_get_word (input_word_stream (f));
+}
+
+size_t
+get_words (FILE *f, word_t *buffer, size_t n)
+{
+  return stream_get_words (input_word_stream (f), buffer, n);
+}
+
+size_t
+get_all_words (FILE *f, word_t **buffer, size_t *size)
+{
+  return stream_get_all_words (input_word_stream (f), buffer, size);
+}
+
+long
+words_left (FILE *f)
+{
+  return stream_words_left (input_word_stream (f));
+}
+
+word_t
+peek_word (FILE *f)
+{
+  return stream_peek_word (input_word_stream (f));
+}
+
+void
+rewind_word (FILE *f)
+{
+  stream_rewind_word (input_word_stream (f));
+}
+
+void
+seek_word (FILE *f, int position)
+{
+  stream_seek_word (input_word_stream (f), position);
+}
+
+void
+write_word (FILE *f, word_t word)
+{
+  stream_write_word (output_word_stream (f), word);
+}
+
+void
+write_words (FILE *f, const word_t *buffer, size_t n)
+{
+  stream_write_words (output_word_stream (f), buffer, n);
+}
+
+void
+flush_word (FILE *f)
+{
+  stream_flush_word (output_word_stream (f));
 }
 
 void
 reset_checksum (word_t word)
 {
-  checksum = word;
+  input_stream.checksum = word;
 }
 
 void
 check_checksum (word_t word)
 {
-  if (word != checksum)
-    printf ("  [WARNING: bad checksum, %012llo /= %012llo]\n", word, checksum);
+  if (word != input_stream.checksum)
+    printf ("  [WARNING: bad checksum, %012llo /= %012llo]\n", word, input_stream.checksum);
 }
 
 word_t
 get_checksummed_word (FILE *f)
 {
-  word_t word = get_word (f);
-
-  checksum = (checksum << 1) + (checksum >> 35) + word;
-  checksum &= 0777777777777ULL;
-
-  return word;
+  return stream_get_checksummed_word (input_word_stream (f));
 }
@@ -13,25 +13,29 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
 #include "dis.h"
+#include "catalog.h"
 
 #define TAPE_FILES 027
 #define TAPE_BLOCKS 01100
 #define BLOCK_WORDS 128
 #define DIRECTORY_BLOCK 0100
 
-word_t image[(TAPE_BLOCKS + 4) * BLOCK_WORDS];
-int blocks;
+/* Per thread, to catalog several tapes at once. */
+__thread word_t image[(TAPE_BLOCKS + 4) * BLOCK_WORDS];
+__thread int blocks;
 static void (*extract) (int, char *);
 int verbose;
 
-int mode[TAPE_FILES];
-int extension[TAPE_FILES];
-int block_area[TAPE_BLOCKS + 1];
+__thread int mode[TAPE_FILES];
+__thread int extension[TAPE_FILES + 1];
+__thread int block_area[TAPE_BLOCKS + 1];
 int block_ptr;
 int direction;
 
@@ -318,6 +322,54 @@ show_files ()
   extract (0, "free-blocks");
 }
 
+/* Check that the chain of extensions from each file comes to an end,
+   as it might not in something else than a DECtape image. */
+static int
+check_extensions (void)
+{
+  int i, n, steps;
+
+  for (i = 0; i < TAPE_FILES; i++)
+    {
+      if (get_dir (i)[0] == 0)
+	continue;
+      for (n = i+1, steps = 0; extension[n]; n = extension[n])
+	if (++steps > TAPE_FILES)
+	  return -1;
+    }
+  return 0;
+}
+
+static int
+catalog_tape (const char *name, struct catalog_file *file)
+{
+  int i, n = 0;
+
+  if (read_catalog_image (name, &dta_word_format, image,
+			  TAPE_BLOCKS * BLOCK_WORDS) == -1)
+    return -1;
+
+  process ();
+  if (check_extensions () == -1)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  for (i = 0; i < TAPE_FILES; i++)
+    {
+      if (get_dir (i)[0] == 0)
+	continue;
+      list_file (i+1, NULL);
+      file[n].fn1 = get_dir (i)[0];
+      file[n].fn2 = get_dir (i)[1];
+      file[n].blocks = blocks;
+      file[n].date = 0;
+      n++;
+    }
+
+  return n;
+}
+
 static int
 allocate_dir (word_t fn1, word_t fn2)
 {
@@ -405,7 +457,9 @@ static void
 usage (const char *x)
 {
   fprintf (stderr, "Usage: %s [-v] [-W<word format>] -x|-t <tape>,\n", x);
-  fprintf (stderr, "or [-N<name>] -c <tape> <files...>\n");
+  fprintf (stderr, "or [-N<name>] -c <tape> <files...>,\n");
+  fprintf (stderr, "or [-n threads] -i <catalog> <tapes or directories...>,\n");
+  fprintf (stderr, "or -q <catalog> <file names...>\n");
   exit (1);
 }
 
@@ -414,7 +468,8 @@ main (int argc, char **argv)
 {
   char *tape_name = NULL;
   char *image_file;
-  int i, create = 0;
+  char *catalog = NULL;
+  int i, create = 0, query = 0, threads = 0;
   word_t *buffer;
   FILE *f;
   int opt;
@@ -424,7 +479,7 @@ main (int argc, char **argv)
   output_word_format = &its_word_format;
   verbose = 0;
 
-  while ((opt = getopt (argc, argv, "vc:t:x:W:N:")) != -1)
+  while ((opt = getopt (argc, argv, "vc:t:x:W:N:i:q:n:")) != -1)
     {
       switch (opt)
 	{
@@ -457,13 +512,34 @@ main (int argc, char **argv)
 	case 'N':
 	  tape_name = optarg;
 	  break;
+	case 'i':
+	case 'q':
+	  if (image_file || catalog)
+	    usage (argv[0]);
+	  query = opt == 'q';
+	  catalog = optarg;
+	  break;
+	case 'n':
+	  threads = atoi (optarg);
+	  break;
 	default:
 	  usage (argv[0]);
 	  break;
 	}
     }
 
-  if (!create && optind != argc)
+  if (catalog && optind == argc)
+    usage (argv[0]);
+  if (catalog && query)
+    return query_catalog (catalog, argv + optind, argc - optind) == 0;
+  if (catalog)
+    {
+      build_catalog (catalog, argv + optind, argc - optind, threads,
+		     catalog_tape);
+      return 0;
+    }
+
+  if (image_file == NULL || (!create && optind != argc))
     usage (argv[0]);
 
   f = fopen (image_file, create ? "wb" : "rb");
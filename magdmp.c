@@ -14,65 +14,176 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "dis.h"
 
+static int files = 0;
+static int words = 0;
+static int eof = 0;
+/* Frames per word, 5 for 9-track tape or 6 for 7-track. */
+static unsigned frames = 5;
+
+/* Count a record of n words, or a tape mark if n is 0.  The file name
+   is in the first three words of a record in an odd numbered file. */
+static void
+record (int n, const word_t *name)
+{
+  char ascii[8];
+
+  words += n;
+  if (n == 0)
+    {
+      files++;
+      if (files & 1)
+        {
+          fprintf (stderr, " %d words\n", words);
+        }
+      words = 0;
+      if (eof)
+        exit (0);
+      eof = 1;
+    }
+  else
+    {
+      eof = 0;
+      if (files == 0)
+        {
+          fprintf (stderr, "Boot record:");
+        }
+      if (files & 1)
+        {
+          fprintf (stderr, "File %d: ", (files >> 1) + 1);
+          sixbit_to_ascii (name[0], ascii);
+          fprintf (stderr, "%s ", ascii);
+          sixbit_to_ascii (name[1], ascii);
+          fprintf (stderr, "%s ", ascii);
+          sixbit_to_ascii (name[2], ascii);
+          fprintf (stderr, "%s", ascii);
+        }
+    }
+}
+
+/* Read every record, when the image can't be indexed. */
+static void
+read_records (FILE *f)
+{
+  word_t *buffer = NULL;
+  int size = 0;
+
+  for (;;)
+    {
+      if (frames == 6)
+        record (read_7track_record (f, &buffer, &size), buffer);
+      else
+        record (read_9track_record (f, &buffer, &size), buffer);
+    }
+}
+
+/* Take the sizes from the tape index, and read only the records with
+   file names. */
+static void
+read_index (FILE *f, const struct tape_index *index)
+{
+  unsigned char octets[18];
+  struct word_stream s;
+  word_t name[3];
+  unsigned reclen;
+  size_t i;
+  int j;
+
+  init_word_stream (&s, f, &tape_word_format);
+  map_word_stream (&s);
+  start_decompress (&s);
+
+  for (i = 0;; i++)
+    {
+      /* The tape ends with marks, even if the image doesn't. */
+      if (i == index->records && index->damaged)
+        exit (1);
+      reclen = i < index->records ? index->record[i].reclen : 0;
+      if (reclen & 0x80000000)
+        {
+          tape_hook (reclen);
+          continue;
+        }
+      if (reclen % frames)
+        {
+          fprintf (stderr, "Not a %s tape image.\n"
+                   "reclen = %d\n", frames == 5 ? "CORE DUMP" : "7-track",
+                   reclen);
+          exit (1);
+        }
+
+      if (reclen != 0 && (files & 1))
+        {
+          memset (octets, 0, sizeof octets);
+          stream_seek (&s, index->record[i].offset + 4);
+          stream_read (&s, octets, reclen < 3 * frames ? reclen : 3 * frames);
+          if (frames == 5)
+            unpack_core_words (octets, name, 3);
+          else
+            for (j = 0; j < 3; j++)
+              name[j] = (((word_t)octets[6*j] & 077) << 30) |
+                        (((word_t)octets[6*j+1] & 077) << 24) |
+                        (((word_t)octets[6*j+2] & 077) << 18) |
+                        (((word_t)octets[6*j+3] & 077) << 12) |
+                        (((word_t)octets[6*j+4] & 077) <<  6) |
+                         ((word_t)octets[6*j+5] & 077);
+        }
+      record (reclen / frames, name);
+    }
+}
+
 int
 main (int argc, char **argv)
 {
-  word_t *buffer;
+  struct tape_index *index = NULL;
   FILE *f;
-  int eof = 0;
-  int files = 0;
-  int words = 0;
+  int opt;
 
-  if (argc != 2)
+  while ((opt = getopt (argc, argv, "79I")) != -1)
     {
-      fprintf (stderr, "Usage: %s <file>\n", argv[0]);
+      switch (opt)
+        {
+        case '7':
+          frames = 6;
+          break;
+        case '9':
+          frames = 5;
+          break;
+        case 'I':
+          /* Keep the tape index in a sidecar next to the image. */
+          write_tape_index = 1;
+          break;
+        default:
+          argc = 0;
+          break;
+        }
+    }
+
+  if (argc != optind + 1)
+    {
+      fprintf (stderr, "Usage: %s [-7|-9] [-I] <file>\n", argv[0]);
       exit (1);
     }
 
   output_file = stdout;
-  f = fopen (argv[1], "rb");
-
-  for (;;)
+  f = fopen (argv[optind], "rb");
+  if (f == NULL)
     {
-      int n;
-      n = get_9track_record (f, &buffer);
-      words += n;
-      if (n == 0)
-	{
-          files++;
-          if (files & 1)
-            {
-              fprintf (stderr, " %d words\n", words);
-            }
-          words = 0;
-	  if (eof)
-	    exit (0);
-	  eof = 1;
-	}
-      else
-	{
-	  char ascii[8];
-	  eof = 0;
-          if (files == 0)
-            {
-              fprintf (stderr, "Boot record:");
-            }
-          if (files & 1)
-            {
-              fprintf (stderr, "File %d: ", (files >> 1) + 1);
-              sixbit_to_ascii (buffer[0], ascii);
-              fprintf (stderr, "%s ", ascii);
-              sixbit_to_ascii (buffer[1], ascii);
-              fprintf (stderr, "%s ", ascii);
-              sixbit_to_ascii (buffer[2], ascii);
-              fprintf (stderr, "%s", ascii);
-            }
-          free (buffer);
-	}
+      fprintf (stderr, "Error opening %s\n", argv[optind]);
+      exit (1);
     }
 
+  if (ftell (f) != -1)
+    index = load_tape_index (argv[optind], f);
+  if (index == NULL)
+    read_records (f);
+  else
+    read_index (f, index);
+
   return 0;
 }
@@ -188,7 +188,7 @@ purify_memory (struct pdp10_memory *memory, int address, int length)
 	  area->flags |= MEMORY_PURE;
 	  length = area->end - area->start;
 	  area->data = malloc (length * sizeof (word_t));
-	  memcpy (area->data, data, length);
+	  memcpy (area->data, data, length * sizeof (word_t));
 	}
       if (area->end > end)
 	{
@@ -204,7 +204,7 @@ purify_memory (struct pdp10_memory *memory, int address, int length)
 	  area->data = malloc (length * sizeof (word_t));
 	  area->flags = 0;
 	  memcpy (area->data, area[-1].data + area[-1].end - area[-1].start,
-		  length);
+		  length * sizeof (word_t));
 	}
       else
 	{
@@ -50,16 +50,21 @@ read_raw (FILE *f, struct pdp10_memory *memory, int cpu_model)
 void
 write_raw_at (FILE *f, struct pdp10_memory *memory, int address)
 {
-  int i, end = memory->area[memory->areas-1].end;
-  word_t word;
+  int i, n = 0, end = memory->area[memory->areas-1].end;
+  word_t buffer[1024];
 
   for (i = address; i < end; i++)
     {
-      word = get_word_at (memory, i);
-      if (word == -1)
-	word = 0;
-      write_word (f, word);
+      buffer[n] = get_word_at (memory, i);
+      if (buffer[n] == -1)
+	buffer[n] = 0;
+      if (++n == 1024)
+	{
+	  write_words (f, buffer, n);
+	  n = 0;
+	}
     }
+  write_words (f, buffer, n);
 
   flush_word (f);
 }
@@ -13,26 +13,65 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
+#include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 #include "tape-image.h"
+#include "libword.h"
 
-static int big_endian = 0;
+/* The state is per thread, so that threads can read one image each. */
+static __thread int big_endian = 0;
+static __thread int padding = -1;
 
+/* Octets read from the image, since a pipe can't tell. */
+static __thread long position;
+
+/* The tape image being read.  Regular files are read from memory, and
+   compressed images are decompressed. */
+static __thread struct word_stream input;
+
+void (*tape_image_error) (const char *message);
+
+/* Report a malformed image to the error hook, or else print it and
+   exit. */
 static void
-read_octets (uint8_t *buffer, int n)
+bad_image (const char *format, ...)
 {
-  int c, i;
+  char message[200];
+  va_list ap;
+
+  va_start (ap, format);
+  vsnprintf (message, sizeof message, format, ap);
+  va_end (ap);
+
+  if (tape_image_error != NULL)
+    tape_image_error (message);
+  printf ("%s\n", message);
+  exit (1);
+}
 
-  for (i = 0; i < n; i++)
+static struct word_stream *
+tape_stream (FILE *f)
+{
+  if (input.file != f)
     {
-      c = getchar ();
-      if (c == EOF)
-        {
-          printf ("Error reading tape image\n");
-          exit (1);
-        }
-      *buffer++ = c;
+      if (input.file != NULL)
+        free_word_stream (&input);
+      memset (&input, 0, sizeof input);
+      input.file = f;
+      position = 0;
+      map_word_stream (&input);
+      start_decompress (&input);
     }
+  return &input;
+}
+
+static void
+read_octets (struct word_stream *s, uint8_t *buffer, uint32_t n)
+{
+  if (stream_read (s, buffer, n) != n)
+    bad_image ("Error reading tape image");
+  position += n;
 }
 
 static uint32_t
@@ -66,13 +105,16 @@ read_reclen (uint8_t *start)
   return x;
 }
 
-uint32_t
-read_record (FILE *f, uint8_t *buffer, uint32_t n)
+/* Read the length before a record.  A length that is large, but
+   small or a special code with the octets swapped, means the image is
+   in the other byte order. */
+static uint32_t
+record_length (struct word_stream *s)
 {
-  uint8_t size[5];
-  uint32_t len, len2;
+  uint8_t size[4];
+  uint32_t len;
 
-  read_octets (size, 4);
+  read_octets (s, size, 4);
   len = read_reclen (size);
   if (len == 0)
     return len;
@@ -81,7 +123,7 @@ read_record (FILE *f, uint8_t *buffer, uint32_t n)
   if ((len >> 24) == 0x80)
     return len;
 
-  if (len > 100000)
+  if (len > 100000 && (swap (len) < len || (swap (len) & 0x80000000) != 0))
     {
       len = swap (len);
       big_endian = !big_endian;
@@ -89,38 +131,200 @@ read_record (FILE *f, uint8_t *buffer, uint32_t n)
 
   if ((len & 0x80000000) != 0)
     return len;
-  if (len > 100000)
+  if ((len >> 24) != 0)
+    bad_image ("Bad record size: %u %x", len, len);
+
+  return len;
+}
+
+/* Read the length after a record, which must be the same.  An odd
+   length followed by a pad octet is SIMH, and without one E11. */
+static void
+record_trailer (struct word_stream *s, uint32_t len)
+{
+  uint8_t size[5];
+  uint32_t len2;
+
+  read_octets (s, size, 4);
+  len2 = read_reclen (size);
+  if (len == len2)
     {
-      printf ("Bad record size: %u %x\n", len, len);
-      exit (1);
+      if (len & 1)
+        padding = 0;
+      return;
     }
 
-  if (len > 0)
+  if (len & 1) {
+    read_octets (s, size + 4, 1);
+    len2 = read_reclen (size + 1);
+  }
+  if (len != len2)
+    bad_image ("Size mismatch\nRecord size: %u %x\nSecond size: %u %x",
+               len, len, len2, len2);
+  padding = 1;
+}
+
+/* Read a record into a buffer of n octets. */
+uint32_t
+read_record (FILE *f, uint8_t *buffer, uint32_t n)
+{
+  struct word_stream *s = tape_stream (f);
+  uint32_t len;
+
+  len = record_length (s);
+  if (len == 0 || (len & 0x80000000) != 0)
+    return len;
+
+  if (len > n)
+    bad_image ("Buffer too small.");
+
+  read_octets (s, buffer, len);
+  record_trailer (s, len);
+  return len;
+}
+
+/* Read a record into *buffer, which is enlarged if it's smaller than
+   the record.  *size is the size of the buffer. */
+uint32_t
+read_record_alloc (FILE *f, uint8_t **buffer, size_t *size)
+{
+  struct word_stream *s = tape_stream (f);
+  uint8_t *p;
+  uint32_t len;
+
+  len = record_length (s);
+  if (len == 0 || (len & 0x80000000) != 0)
+    return len;
+
+  if (len > *size)
     {
-      if (len > n)
+      p = realloc (*buffer, len);
+      if (p == NULL)
         {
-          printf ("Buffer too small.\n");
+          printf ("Out of memory.\n");
           exit (1);
         }
+      *buffer = p;
+      *size = len;
+    }
+
+  read_octets (s, *buffer, len);
+  record_trailer (s, len);
+  return len;
+}
+
+/* Read the rest of the tape image, and return the number of octets. */
+size_t
+skip_tape_image (FILE *f)
+{
+  struct word_stream *s = tape_stream (f);
+  uint8_t buffer[65536];
+  size_t n, total = 0;
 
-      read_octets (buffer, len);
-      read_octets (size, 4);
-      len2 = read_reclen (size);
-      if (len != len2)
+  while ((n = stream_read (s, buffer, sizeof buffer)) > 0)
+    total += n;
+  position += total;
+  return total;
+}
+
+/* Nonzero if there are no more records in the image. */
+int
+end_of_tape_image (FILE *f)
+{
+  size_t got;
+  stream_peek (tape_stream (f), 4, &got);
+  return got < 4;
+}
+
+/* The octet offset of the next record in the image. */
+long
+tape_image_offset (FILE *f)
+{
+  tape_stream (f);
+  return position;
+}
+
+/* Go back to an offset from tape_image_offset. */
+void
+seek_tape_image (FILE *f, long offset)
+{
+  stream_seek (tape_stream (f), offset);
+  position = offset;
+}
+
+/* Skip the rest of the current file on the tape, up to and including
+   the next tape mark, and add the number of data records to *records.
+   The data isn't read if the image is in memory.  Return 0 if the end
+   of the image came before a tape mark. */
+int
+skip_tape_file (FILE *f, size_t *records)
+{
+  struct word_stream *s = tape_stream (f);
+  uint8_t buffer[65536];
+  size_t got;
+  uint32_t len, n;
+
+  for (;;)
+    {
+      if (end_of_tape_image (f))
+        return 0;
+      len = record_length (s);
+      if (len == 0)
+        return 1;
+      if ((len & 0x80000000) != 0)
+        continue;
+
+      if (s->map != NULL || s->decompress != NULL)
         {
-          if (len & 1) {
-            read_octets (size + 4, 1);
-            len2 = read_reclen (size + 1);
-          }
-          if (len != len2)
-            {
-              printf ("Size mismatch\n");
-              printf ("Record size: %u %x\n", len, len);
-              printf ("Second size: %u %x\n", len2, len2);
-              exit (1);
-            }
+          stream_seek (s, stream_tell (s) + len);
+          position += len;
         }
+      else
+        for (n = len; n > 0; n -= got)
+          {
+            got = n < sizeof buffer ? n : sizeof buffer;
+            read_octets (s, buffer, got);
+          }
+      record_trailer (s, len);
+      (*records)++;
     }
+}
 
-  return len;
+/* Count the data records in the rest of the image. */
+size_t
+count_records (FILE *f)
+{
+  size_t records = 0;
+  while (skip_tape_file (f, &records))
+    ;
+  return records;
+}
+
+/* Forget about the image, before closing it or reading another image
+   from the same FILE. */
+void
+close_tape_image (FILE *f)
+{
+  if (input.file != f)
+    return;
+  free_word_stream (&input);
+  memset (&input, 0, sizeof input);
+  position = 0;
+  big_endian = 0;
+  padding = -1;
+}
+
+/* Nonzero if the image has been found to be big endian. */
+int
+tape_image_big_endian (void)
+{
+  return big_endian;
+}
+
+/* 1 if odd records have been seen padded as in SIMH images, 0 if
+   unpadded as in E11 images, or -1 if it's not known yet. */
+int
+tape_image_padding (void)
+{
+  return padding;
 }
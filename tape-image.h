@@ -17,4 +17,18 @@
 #include <stdint.h>
 
 extern uint32_t read_record (FILE *f, uint8_t *buffer, uint32_t n);
+extern uint32_t read_record_alloc (FILE *f, uint8_t **buffer, size_t *size);
+extern size_t skip_tape_image (FILE *f);
+extern int end_of_tape_image (FILE *f);
+extern long tape_image_offset (FILE *f);
+extern void seek_tape_image (FILE *f, long offset);
+extern int skip_tape_file (FILE *f, size_t *records);
+extern size_t count_records (FILE *f);
+extern void close_tape_image (FILE *f);
+extern int tape_image_big_endian (void);
+extern int tape_image_padding (void);
+
+/* Called with a message when an image is malformed, instead of
+   printing it and exiting.  It must not return. */
+extern void (*tape_image_error) (const char *message);
 
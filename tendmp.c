@@ -13,12 +13,15 @@
     You should have received a copy of the GNU General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 
 #include "dis.h"
 #include "memory.h"
+#include "catalog.h"
 
 #define TAPE_BLOCKS      01102
 #define BLOCK_WORDS      128
@@ -39,15 +42,16 @@
 #define SWP   0636760000000LL
 #define SAV   0634166000000LL
 
-static word_t image[TAPE_BLOCKS * BLOCK_WORDS];
-static int blocks;
+/* Per thread, to catalog several tapes at once. */
+static __thread word_t image[TAPE_BLOCKS * BLOCK_WORDS];
+static __thread int blocks;
 static void (*visit) (int, char *);
 static int verbose;
 static int spacing;
 static void (*start_alloc) (void);
 
-static int timestamp[TAPE_FILES];
-static int block_area[TAPE_BLOCKS + 4];
+static __thread int timestamp[TAPE_FILES];
+static __thread int block_area[TAPE_BLOCKS + 4];
 static int block_ptr;
 static int direction;
 
@@ -376,6 +380,69 @@ show_files ()
     }
 }
 
+/* Check that following the blocks of each file stays on the tape and
+   comes to an end, as it might not in something else than a DECtape
+   image. */
+static int
+check_links (void)
+{
+  int visited[TAPE_BLOCKS];
+  word_t *dir = get_block (DIRECTORY_BLOCK);
+  word_t header;
+  int i, block;
+
+  memset (visited, 0, sizeof visited);
+  for (i = 0; i < TAPE_FILES; i++)
+    {
+      if (dir[FILE_NAME + i] == 0)
+	continue;
+      for (block = find (i+1); block > 0; block = LINK (header))
+	{
+	  if (block >= TAPE_BLOCKS || visited[block] == i+1)
+	    return -1;
+	  visited[block] = i+1;
+	  header = get_block (block)[0];
+	  if (SIZE (header) > DATA_WORDS)
+	    return -1;
+	}
+    }
+  return 0;
+}
+
+static int
+catalog_tape (const char *name, struct catalog_file *file)
+{
+  word_t *dir;
+  int i, n = 0;
+
+  if (read_catalog_image (name, &dta_word_format, image,
+			  TAPE_BLOCKS * BLOCK_WORDS) == -1)
+    return -1;
+  for (i = 0; i < TAPE_BLOCKS * BLOCK_WORDS; i++)
+    image[i] &= 0777777777777LL;
+
+  process ();
+  if (check_links () == -1)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+  dir = get_block (DIRECTORY_BLOCK);
+  for (i = 0; i < TAPE_FILES; i++)
+    {
+      if (dir[FILE_NAME + i] == 0)
+	continue;
+      list_file (i+1, NULL);
+      file[n].fn1 = dir[FILE_NAME + i];
+      file[n].fn2 = dir[FILE_EXT + i] & 0777777000000LL;
+      file[n].blocks = blocks;
+      file[n].date = timestamp[i];
+      n++;
+    }
+
+  return n;
+}
+
 static int
 allocate_dir (word_t fn1, word_t fn2)
 {
@@ -566,7 +633,9 @@ static void
 usage (const char *x)
 {
   fprintf (stderr, "Usage: %s [-v] [-W<word format>] -x|-t <tape>,\n", x);
-  fprintf (stderr, "or [-T] [-L<label>] [-b<boot blocks>] -c <tape> <files...>\n");
+  fprintf (stderr, "or [-T] [-L<label>] [-b<boot blocks>] -c <tape> <files...>,\n");
+  fprintf (stderr, "or [-n threads] -i <catalog> <tapes or directories...>,\n");
+  fprintf (stderr, "or -q <catalog> <file names...>\n");
   exit (1);
 }
 
@@ -575,7 +644,8 @@ main (int argc, char **argv)
 {
   char *label = NULL;
   char *image_file, *boot_file = NULL;
-  int i, create = 0;
+  char *catalog = NULL;
+  int i, create = 0, query = 0, threads = 0;
   word_t *buffer;
   FILE *f;
   int opt;
@@ -589,7 +659,7 @@ main (int argc, char **argv)
 
   output_file = fopen ("/dev/null", "w");
 
-  while ((opt = getopt (argc, argv, "vc:t:x:W:L:b:T")) != -1)
+  while ((opt = getopt (argc, argv, "vc:t:x:W:L:b:Ti:q:n:")) != -1)
     {
       switch (opt)
 	{
@@ -630,13 +700,34 @@ main (int argc, char **argv)
 	case 'T':
 	  start_alloc = start_temdmp;
 	  break;
+	case 'i':
+	case 'q':
+	  if (image_file || catalog)
+	    usage (argv[0]);
+	  query = opt == 'q';
+	  catalog = optarg;
+	  break;
+	case 'n':
+	  threads = atoi (optarg);
+	  break;
 	default:
 	  usage (argv[0]);
 	  break;
 	}
     }
 
-  if (!create && optind != argc)
+  if (catalog && optind == argc)
+    usage (argv[0]);
+  if (catalog && query)
+    return query_catalog (catalog, argv + optind, argc - optind) == 0;
+  if (catalog)
+    {
+      build_catalog (catalog, argv + optind, argc - optind, threads,
+		     catalog_tape);
+      return 0;
+    }
+
+  if (image_file == NULL || (!create && optind != argc))
     usage (argv[0]);
 
   f = fopen (image_file, create ? "wb" : "rb");
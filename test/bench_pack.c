@@ -0,0 +1,130 @@
+/* Microbenchmark for the octet packing kernels in libword.  Runs the
+   kernels selected for this CPU and the scalar ones on the same data,
+   checks that they agree, and prints the throughput of each. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libword.h"
+
+#define WORDS (1024 * 1024)
+#define ROUNDS 50
+
+static unsigned char octets[8 * WORDS + 64];
+static unsigned char packed[2][8 * WORDS + 64];
+static word_t words[2][WORDS + 8];
+static word_t inplace[2][WORDS + 8];
+
+static double
+now (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+report (const char *kernels, const char *name, size_t bytes, double t)
+{
+  printf ("%-8s %-14s %8.1f MB/s\n", kernels, name,
+	  bytes * (double)ROUNDS / t / 1e6);
+}
+
+static void
+run (int k)
+{
+  const char *kernels = pack_kernels ();
+  double t;
+  int i;
+
+  t = now ();
+  for (i = 0; i < ROUNDS; i++)
+    unpack_core_words (octets, words[k], WORDS);
+  report (kernels, "unpack core", 5 * WORDS, now () - t);
+
+  t = now ();
+  for (i = 0; i < ROUNDS; i++)
+    pack_core_words (words[k], packed[k], WORDS);
+  report (kernels, "pack core", 5 * WORDS, now () - t);
+
+  t = now ();
+  for (i = 0; i < ROUNDS; i++)
+    unpack_bin_words (octets, words[k], WORDS / 2);
+  report (kernels, "unpack bin", 9 * WORDS / 2, now () - t);
+
+  t = now ();
+  for (i = 0; i < ROUNDS; i++)
+    pack_bin_words (words[k], packed[k], WORDS / 2);
+  report (kernels, "pack bin", 9 * WORDS / 2, now () - t);
+
+  t = now ();
+  for (i = 0; i < ROUNDS; i++)
+    unpack_data8_words (octets, words[k], WORDS);
+  report (kernels, "unpack data8", 8 * WORDS, now () - t);
+
+  t = now ();
+  for (i = 0; i < ROUNDS; i++)
+    pack_data8_words (words[k], packed[k], WORDS);
+  report (kernels, "pack data8", 8 * WORDS, now () - t);
+
+  /* Leave the buffers with results from core words, for comparison. */
+  unpack_core_words (octets, words[k], WORDS);
+  pack_core_words (words[k], packed[k], WORDS);
+  memcpy (inplace[k], octets, 5 * WORDS);
+  unpack_core_words ((unsigned char *)inplace[k], inplace[k], WORDS);
+}
+
+static int
+check (void)
+{
+  int k, n, ok = 1;
+
+  if (memcmp (words[0], words[1], sizeof words[0]) != 0
+      || memcmp (packed[0], packed[1], sizeof packed[0]) != 0
+      || memcmp (inplace[0], inplace[1], sizeof inplace[0]) != 0)
+    ok = 0;
+
+  /* Odd sizes exercise the scalar tails. */
+  for (n = 0; n < 40; n++)
+    {
+      for (k = 0; k < 2; k++)
+	{
+	  select_pack_kernels (k);
+	  unpack_bin_words (octets, words[k], n);
+	  pack_bin_words (words[k], packed[k], n);
+	  unpack_data8_words (octets, words[k] + 2 * n, n);
+	  memcpy (inplace[k], octets, 5 * n);
+	  unpack_core_words ((unsigned char *)inplace[k], inplace[k], n);
+	  pack_core_words (inplace[k], packed[k] + 9 * n, n);
+	}
+      if (memcmp (words[0], words[1], 3 * n * sizeof (word_t)) != 0
+	  || memcmp (packed[0], packed[1], 14 * n) != 0
+	  || memcmp (inplace[0], inplace[1], n * sizeof (word_t)) != 0)
+	ok = 0;
+    }
+
+  return ok;
+}
+
+int
+main (void)
+{
+  size_t i;
+
+  srand (1);
+  for (i = 0; i < sizeof octets; i++)
+    octets[i] = rand ();
+
+  run (1);
+  select_pack_kernels (0);
+  run (0);
+
+  if (!check ())
+    {
+      printf ("Kernels disagree!\n");
+      return 1;
+    }
+
+  return 0;
+}
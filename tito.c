@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -37,12 +38,43 @@ static int saveset = 1;
 static FILE *list;
 static FILE *info;
 
-static FILE *output;
 static word_t checksum;
 static char file_path[100];
+static int extracting;
 static struct timeval timestamp[2];
 static int first_file;
 
+/* Extracted files are written behind the reading of the tape, by a
+   thread taking chunks from a bounded queue.  A chunk holds the data
+   from one record, and may start or end a file.  There is just one
+   writer, so files are written in tape order, and memory use is the
+   same however long the tape. */
+struct chunk {
+  int open, close;
+  char directory[14];
+  char path[100];
+  char alternate[100];
+  struct timeval timestamp[2];
+  word_t data[3740];
+  int size;
+};
+
+#define QUEUE 16
+
+static struct chunk queue[QUEUE];
+static struct chunk *chunk;
+static int queue_head, queue_count, queue_done;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer;
+static int writing;
+
+/* The writer's file. */
+static FILE *output;
+static struct word_stream output_stream;
+static char output_path[100];
+static char made_directory[14];
+
 static int
 february (int year)
 {
@@ -229,14 +261,18 @@ process_header (FILE *f, word_t word, int trailer)
     fprintf (stderr, "EXPECTED 1,,2\n");
 }
 
+/* Read the rest of a record.  A word starting a record or file can
+   only be the first one got, since get_words stops at the end of a
+   record. */
 static void
 get_block (FILE *f, word_t *buffer, int words)
 {
+  size_t n;
   int i;
-  for (i = 0; i < words; i++)
+  for (i = 0; i < words; i += n)
     {
-      buffer[i] = get_word (f);
-      if (buffer[i] & (START_FILE|START_RECORD))
+      n = get_words (f, buffer + i, words - i);
+      if (n == 0 || (buffer[i] & (START_FILE|START_RECORD)))
 	{
 	  fprintf (stderr, "Record too short.\n");
 	  exit (1);
@@ -264,15 +300,157 @@ check_block_size (int n)
     }
 }
 
+/* Files from the same user follow each other, so the directory was
+   most likely made for the file before. */
+static void
+make_directory (const char *directory)
+{
+  if (strcmp (directory, made_directory) == 0)
+    return;
+  if (mkdir (directory, 0777) == -1 && errno != EEXIST)
+    fprintf (stderr, "Error creating output directory %s: %s\n",
+	     directory, strerror (errno));
+  strcpy (made_directory, directory);
+}
+
+static void
+write_chunk (struct chunk *c)
+{
+  if (c->open)
+    {
+      make_directory (c->directory);
+      strcpy (output_path, c->path);
+      output = fopen (output_path, "rb");
+      if (output != NULL)
+	{
+	  fclose (output);
+	  strcpy (output_path, c->alternate);
+	}
+      output = fopen (output_path, "wb");
+      if (output == NULL)
+	fprintf (stderr, "Error opening output file %s: %s\n",
+		 output_path, strerror (errno));
+      else
+	init_word_stream (&output_stream, output, output_word_format);
+    }
+
+  if (output == NULL)
+    return;
+  stream_write_words (&output_stream, c->data, c->size);
+
+  if (c->close)
+    {
+      stream_flush_word (&output_stream);
+      free_word_stream (&output_stream);
+      fclose (output);
+      output = NULL;
+      utimes (output_path, c->timestamp);
+    }
+}
+
+static void *
+write_chunks (void *arg)
+{
+  struct chunk *c;
+
+  (void)arg;
+  for (;;)
+    {
+      pthread_mutex_lock (&queue_lock);
+      while (queue_count == 0 && !queue_done)
+	pthread_cond_wait (&queue_cond, &queue_lock);
+      if (queue_count == 0)
+	{
+	  pthread_mutex_unlock (&queue_lock);
+	  return NULL;
+	}
+      c = &queue[queue_head];
+      pthread_mutex_unlock (&queue_lock);
+
+      /* The chunk stays in the queue until written, so it isn't
+	 reused meanwhile. */
+      write_chunk (c);
+
+      pthread_mutex_lock (&queue_lock);
+      queue_head = (queue_head + 1) % QUEUE;
+      queue_count--;
+      pthread_cond_broadcast (&queue_cond);
+      pthread_mutex_unlock (&queue_lock);
+    }
+}
+
+/* Let the writer finish the queue.  This is also done on exit, so
+   that everything read is written. */
+static void
+finish_writer (void)
+{
+  if (!writing)
+    return;
+  pthread_mutex_lock (&queue_lock);
+  queue_done = 1;
+  pthread_cond_broadcast (&queue_cond);
+  pthread_mutex_unlock (&queue_lock);
+  pthread_join (writer, NULL);
+  writing = 0;
+}
+
+static void
+start_writer (void)
+{
+  writing = pthread_create (&writer, NULL, write_chunks, NULL) == 0;
+  if (writing)
+    atexit (finish_writer);
+}
+
+/* Get the next free chunk, waiting for the writer if the queue is
+   full. */
+static struct chunk *
+next_chunk (void)
+{
+  struct chunk *c;
+
+  pthread_mutex_lock (&queue_lock);
+  while (queue_count == QUEUE)
+    pthread_cond_wait (&queue_cond, &queue_lock);
+  c = &queue[(queue_head + queue_count) % QUEUE];
+  pthread_mutex_unlock (&queue_lock);
+
+  c->open = c->close = 0;
+  c->size = 0;
+  return c;
+}
+
+/* Hand the chunk to the writer.  Without a writer thread, write it
+   here. */
+static void
+queue_chunk (void)
+{
+  if (chunk == NULL)
+    return;
+
+  if (!writing)
+    write_chunk (chunk);
+  else
+    {
+      pthread_mutex_lock (&queue_lock);
+      queue_count++;
+      pthread_cond_broadcast (&queue_cond);
+      pthread_mutex_unlock (&queue_lock);
+    }
+  chunk = NULL;
+}
+
 static void
 close_file (word_t x)
 {
   checksum &= 0777777777777;
   fprintf (info, "Checksum: %012llo (%012llo)\n", checksum, x);
-  flush_word (output);
-  fclose (output);
-  output = NULL;
-  utimes (file_path, timestamp);
+  if (chunk == NULL)
+    return;
+  chunk->close = 1;
+  chunk->timestamp[0] = timestamp[0];
+  chunk->timestamp[1] = timestamp[1];
+  extracting = 0;
 }
 
 static void
@@ -280,25 +458,18 @@ open_file (char *directory, char *name, char *ext)
 {
   weenixname (directory);
   fprintf (info, "DIRECTORY: %s\n", directory);
-  if (mkdir (directory, 0777) == -1 && errno != EEXIST)
-    fprintf (stderr, "Error creating output directory %s: %s\n",
-	     directory, strerror (errno));
 
   weenixname (name);
   weenixname (ext);
   sprintf (file_path, "%s/%s%s%s", directory, name, *ext ? "." : "", ext);
-
   fprintf (info, "FILE: %s\n", file_path);
-  output = fopen (file_path, "rb");
-  if (output != NULL)
-    {
-      fclose (output);
-      sprintf (file_path, "%s/%s.%s.%d", directory, name, ext, saveset);
-    }
-  output = fopen (file_path, "wb");
-  if (output == NULL)
-    fprintf (stderr, "Error opening output file %s: %s\n",
-	     file_path, strerror (errno));
+
+  chunk = next_chunk ();
+  chunk->open = 1;
+  strcpy (chunk->directory, directory);
+  strcpy (chunk->path, file_path);
+  sprintf (chunk->alternate, "%s/%s.%s.%d", directory, name, ext, saveset);
+  extracting = 1;
 
   checksum = 0;
 }
@@ -307,11 +478,15 @@ static void
 write_data (word_t *data, int size)
 {
   int i;
+
   for (i = 0; i < size; i++)
-    {
-      checksum += *data;
-      write_word (output, *data++);
-    }
+    checksum += data[i];
+  if (!extracting)
+    return;
+  if (chunk == NULL)
+    chunk = next_chunk ();
+  memcpy (chunk->data + chunk->size, data, size * sizeof *data);
+  chunk->size += size;
 }
 
 static word_t
@@ -406,6 +581,7 @@ process_file_header (FILE *f, word_t word)
       write_data (block + 0101, size - 0101);
       if (!data_record (word))
 	close_file (block[size - 1]);
+      queue_chunk ();
     }
 
   return word;
@@ -434,10 +610,12 @@ process_data (FILE *f, word_t word)
   /* Check the next record to see if this is the end of the current file. */
   word = get_word (f);
   if (extract)
-    write_data (block, size);
-
-  if (!data_record (word) && extract)
-    close_file (block[size - 1]);
+    {
+      write_data (block, size);
+      if (!data_record (word))
+	close_file (block[size - 1]);
+      queue_chunk ();
+    }
   return word;
 }
 
@@ -477,10 +655,40 @@ process_saveset (FILE *f)
   process_header (f, word, 1);
 }
 
+/* Make the next word read be the start of saveset n, counting from 1,
+   using the tape index to find the tape file it's in. */
+static void
+seek_saveset (FILE *f, const char *name, int n)
+{
+  struct tape_index *index = load_tape_index (name, f);
+  int file, found = 0;
+  word_t word;
+
+  if (index == NULL)
+    {
+      fprintf (stderr, "Can't seek in unseekable tape image.\n");
+      exit (1);
+    }
+
+  for (file = 0; seek_tape_file (f, index, file) == 0; file++)
+    {
+      if (peek_tape_record (f, index, &word, 1) == 1
+	  && saveset_record (word) && ++found == n)
+	{
+	  saveset = n;
+	  free_tape_index (index);
+	  return;
+	}
+    }
+
+  fprintf (stderr, "No saveset %d on tape.\n", n);
+  exit (1);
+}
+
 static void
 usage (const char *x)
 {
-  fprintf (stderr, "Usage: %s -t|-x [-v] [-7] [-Wformat] [-f file]\n", x);
+  fprintf (stderr, "Usage: %s -t|-x [-v] [-7] [-Wformat] [-f file] [-s saveset] [-I]\n", x);
   usage_word_format ();
   exit (1);
 }
@@ -488,7 +696,9 @@ usage (const char *x)
 int
 main (int argc, char **argv)
 {
+  char *tape_name = NULL;
   FILE *f = NULL;
+  int start = 0;
   int opt;
 
   input_word_format = &tape_word_format;
@@ -497,7 +707,7 @@ main (int argc, char **argv)
   if (argc == 1)
     usage (argv[0]);
 
-  while ((opt = getopt (argc, argv, "tvx7f:W:")) != -1)
+  while ((opt = getopt (argc, argv, "tvx7f:Is:W:")) != -1)
     {
       switch (opt)
 	{
@@ -514,6 +724,13 @@ main (int argc, char **argv)
 		       optarg, strerror (errno));
 	      exit (1);
 	    }
+	  tape_name = optarg;
+	  break;
+	case 's':
+	  start = atoi (optarg);
+	  break;
+	case 'I':
+	  write_tape_index = 1;
 	  break;
 	case 't':
 	  verbose++;
@@ -539,12 +756,23 @@ main (int argc, char **argv)
   if (f == NULL)
     f = stdin;
 
+  /* Go straight to the saveset using the tape index. */
+  if (start > 0)
+    {
+      if (tape_name == NULL)
+	usage (argv[0]);
+      seek_saveset (f, tape_name, start);
+    }
+
   list = info = stdout;
   if (verbose == 0)
     list = info = fopen ("/dev/null", "w");
   else if (verbose == 1)
     info = fopen ("/dev/null", "w");
 
+  if (extract)
+    start_writer ();
+
   for (;;)
     process_saveset (f);
 